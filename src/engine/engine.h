@@ -432,6 +432,7 @@ extern void cleanupva();
 
 extern bool isfoggedsphere(float rad, const vec &cv);
 extern int isvisiblesphere(float rad, const vec &cv);
+extern int isvisiblecube(const ivec &o, int size);
 extern bool bboccluded(const ivec &bo, const ivec &br);
 
 extern int deferquery;
@@ -3457,112 +3457,16 @@ void gendds(char *infile, char *outfile)
 }
 COMMAND(gendds, "ss");
 
-void writepngchunk(stream *f, const char *type, uchar *data = NULL, uint len = 0)
-{
-    f->putbig<uint>(len);
-    f->write(type, 4);
-    f->write(data, len);
-
-    uint crc = crc32(0, Z_NULL, 0);
-    crc = crc32(crc, (const Bytef *)type, 4);
-    if(data) crc = crc32(crc, data, len);
-    f->putbig<uint>(crc);
-}
-
 VARP(compresspng, 0, 9, 9);
 
 void savepng(const char *filename, ImageData &image, bool flip)
 {
-    uchar ctype = 0;
-    switch(image.bpp)
-    {
-        case 1: ctype = 0; break;
-        case 2: ctype = 4; break;
-        case 3: ctype = 2; break;
-        case 4: ctype = 6; break;
-        default: conoutf(CON_ERROR, "failed saving png to %s", filename); return;
-    }
+    if(image.bpp < 1 || image.bpp > 4) { conoutf(CON_ERROR, "failed saving png to %s", filename); return; }
     stream *f = openfile(filename, "wb");
     if(!f) { conoutf(CON_ERROR, "could not write to %s", filename); return; }
-
-    uchar signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
-    f->write(signature, sizeof(signature));
-
-    struct pngihdr
-    {
-        uint width, height;
-        uchar bitdepth, colortype, compress, filter, interlace;
-    } ihdr = { bigswap<uint>(image.w), bigswap<uint>(image.h), 8, ctype, 0, 0, 0 };
-    writepngchunk(f, "IHDR", (uchar *)&ihdr, 13);
-
-    stream::offset idat = f->tell();
-    uint len = 0;
-    f->write("\0\0\0\0IDAT", 8);
-    uint crc = crc32(0, Z_NULL, 0);
-    crc = crc32(crc, (const Bytef *)"IDAT", 4);
-
-    z_stream z;
-    z.zalloc = NULL;
-    z.zfree = NULL;
-    z.opaque = NULL;
-
-    if(deflateInit(&z, compresspng) != Z_OK)
-        goto error;
-
-    uchar buf[1<<12];
-    z.next_out = (Bytef *)buf;
-    z.avail_out = sizeof(buf);
-
-    loopi(image.h)
-    {
-        uchar filter = 0;
-        loopj(2)
-        {
-            z.next_in = j ? (Bytef *)image.data + (flip ? image.h-i-1 : i)*image.pitch : (Bytef *)&filter;
-            z.avail_in = j ? image.w*image.bpp : 1;
-            while(z.avail_in > 0)
-            {
-                if(deflate(&z, Z_NO_FLUSH) != Z_OK) goto cleanuperror;
-                #define FLUSHZ do { \
-                    int flush = sizeof(buf) - z.avail_out; \
-                    crc = crc32(crc, buf, flush); \
-                    len += flush; \
-                    f->write(buf, flush); \
-                    z.next_out = (Bytef *)buf; \
-                    z.avail_out = sizeof(buf); \
-                } while(0)
-                FLUSHZ;
-            }
-        }
-    }
-
-    for(;;)
-    {
-        int err = deflate(&z, Z_FINISH);
-        if(err != Z_OK && err != Z_STREAM_END) goto cleanuperror;
-        FLUSHZ;
-        if(err == Z_STREAM_END) break;
-    }
-
-    deflateEnd(&z);
-
-    f->seek(idat, SEEK_SET);
-    f->putbig<uint>(len);
-    f->seek(0, SEEK_END);
-    f->putbig<uint>(crc);
-
-    writepngchunk(f, "IEND");
-
+    bool written = writepng(f, image.data, image.w, image.h, image.bpp, image.pitch, flip, compresspng);
     delete f;
-    return;
-
-cleanuperror:
-    deflateEnd(&z);
-
-error:
-    delete f;
-
-    conoutf(CON_ERROR, "failed saving png to %s", filename);
+    if(!written) conoutf(CON_ERROR, "failed saving png to %s", filename);
 }
 
 struct tgaheader
@@ -0,0 +1,150 @@
+#include "game.h"
+#include "worldgen.h"
+
+namespace game
+{
+    static const int WORM_POINTS = 12;
+    static const float WORM_STEP = 8.0f;
+    static const float WORM_MAX_RADIUS = 16.0f;
+    // Spline overshoot is well under a step, so a worm never reaches further
+    // than this from its first point, which lies inside its source chunk.
+    static const int WORM_RANGE = (CHUNK_SIZE + int((WORM_POINTS - 1) * WORM_STEP + WORM_STEP + WORM_MAX_RADIUS) + CHUNK_SIZE - 1) / CHUNK_SIZE;
+
+    // How often worms start in a chunk (percent), how many at most, one in how
+    // many is a cavern and how wide they are. The deep layers are far more
+    // open than the surface, so their worms are denser and larger.
+    static const struct WormLayer
+    {
+        int chance, maxWorms, cavernChance;
+        float radiusScale;
+    } wormLayers[LAYER_SKIES] =
+    {
+        { 100, 6, 2, 1.6f },
+        { 80, 4, 4, 1.25f },
+        { 40, 3, 8, 1.0f }
+    };
+
+    struct Worm
+    {
+        vec points[WORM_POINTS];
+        float radius[WORM_POINTS];
+        float squash;
+        int count;
+    };
+
+    void CarveMask::carveSpan(int x, int z, int minY, int maxY)
+    {
+        uint *column = bits[z * CHUNK_SIZE + x];
+        for(int y = minY; y <= maxY;)
+        {
+            int word = y >> 5, first = y & 31, last = min(maxY - (y & ~31), 31);
+            uint span = last - first == 31 ? ~0u : ((1u << (last - first + 1)) - 1) << first;
+            column[word] |= span;
+            y = (word + 1) << 5;
+        }
+    }
+
+    static void buildWorm(ChunkRandom &rng, int sourceX, int sourceZ, const WorldLayerData &layer, const WormLayer &params, Worm &worm)
+    {
+        // Surface worms start below sea level so most of them stay under the
+        // terrain; the odd one that climbs out becomes a cave entrance.
+        int startMax = layer.layer == LAYER_SURFACE ? WORLD_SEA_LEVEL - 24 : layer.maxY;
+        vec pos(sourceX * CHUNK_SIZE + rng.nextFloat() * CHUNK_SIZE,
+                layer.minY + rng.nextFloat() * (startMax - layer.minY),
+                sourceZ * CHUNK_SIZE + rng.nextFloat() * CHUNK_SIZE);
+
+        bool cavern = rng.next(params.cavernChance) == 0;
+        float baseRadius = (cavern ? 5.0f + rng.nextFloat() * 4.0f : 1.5f + rng.nextFloat() * 2.5f) * params.radiusScale;
+        worm.squash = cavern ? 0.6f : 0.75f;
+        worm.count = cavern ? 3 + rng.next(3) : 6 + rng.next(WORM_POINTS - 5);
+
+        float yaw = rng.nextFloat() * 2 * PI, pitch = (rng.nextFloat() - 0.5f) * 0.5f;
+        loopi(worm.count)
+        {
+            float radius = baseRadius * (0.8f + rng.nextFloat() * 0.4f);
+            if(!cavern && (i == 0 || i == worm.count - 1)) radius *= 0.6f;
+            pos.y = clamp(pos.y, float(layer.minY) + radius, float(layer.maxY));
+            worm.points[i] = pos;
+            worm.radius[i] = min(radius, WORM_MAX_RADIUS);
+
+            yaw += (rng.nextFloat() - 0.5f) * 1.2f;
+            pitch = clamp(pitch * 0.7f + (rng.nextFloat() - 0.5f) * 0.6f, -0.8f, 0.8f);
+            pos.add(vec(cosf(yaw) * cosf(pitch), sinf(pitch), sinf(yaw) * cosf(pitch)).mul(WORM_STEP));
+        }
+    }
+
+    static inline float catmullRom(float p0, float p1, float p2, float p3, float t)
+    {
+        return 0.5f * (2 * p1 + (p2 - p0) * t + (2 * p0 - 5 * p1 + 4 * p2 - p3) * t * t + (3 * (p1 - p2) + p3 - p0) * t * t * t);
+    }
+
+    // Carves an ellipsoid at center as one y span per column of the target
+    // chunk, clipped to the worm's layer.
+    static void carveBlob(const vec &center, float radius, float squash, int chunkWorldX, int chunkWorldZ, const WorldLayerData &layer, CarveMask &mask)
+    {
+        int minX = max(int(ceilf(center.x - radius - 0.5f)) - chunkWorldX, 0), maxX = min(int(floorf(center.x + radius - 0.5f)) - chunkWorldX, CHUNK_SIZE - 1);
+        int minZ = max(int(ceilf(center.z - radius - 0.5f)) - chunkWorldZ, 0), maxZ = min(int(floorf(center.z + radius - 0.5f)) - chunkWorldZ, CHUNK_SIZE - 1);
+        float invRadius2 = 1.0f / (radius * radius), height = radius * squash;
+        for(int z = minZ; z <= maxZ; ++z)
+        {
+            float dz = chunkWorldZ + z + 0.5f - center.z;
+            for(int x = minX; x <= maxX; ++x)
+            {
+                float dx = chunkWorldX + x + 0.5f - center.x;
+                float d2 = (dx * dx + dz * dz) * invRadius2;
+                if(d2 >= 1) continue;
+                float h = height * sqrtf(1 - d2);
+                int minY = max(int(ceilf(center.y - h - 0.5f)), layer.minY), maxY = min(int(floorf(center.y + h - 0.5f)), layer.maxY);
+                if(minY <= maxY) mask.carveSpan(x, z, minY, maxY);
+            }
+        }
+    }
+
+    void CaveCarver::carveWorms(int sourceX, int sourceZ, int layer, const ChunkCoord &target, CarveMask &mask) const
+    {
+        ChunkRandom rng(seed ^ (uint(sourceX) * 0x8DA6B343u) ^ (uint(sourceZ) * 0xD8163841u) ^ (uint(layer + 1) * 0xCB1AB31Fu));
+        const WormLayer &params = wormLayers[layer];
+        int worms = rng.next(100) < params.chance ? 1 + rng.next(params.maxWorms) : 0;
+        if(!worms) return;
+
+        const WorldLayerData &layerData = WorldLayerManager::getLayerData(WorldLayer(layer));
+        int chunkWorldX = target.x * CHUNK_SIZE, chunkWorldZ = target.z * CHUNK_SIZE;
+        float boxMinX = chunkWorldX, boxMaxX = chunkWorldX + CHUNK_SIZE;
+        float boxMinZ = chunkWorldZ, boxMaxZ = chunkWorldZ + CHUNK_SIZE;
+
+        Worm worm;
+        loopj(worms)
+        {
+            // Always build the whole worm so the generator state, and with it
+            // the next worm, does not depend on which chunk is being carved.
+            buildWorm(rng, sourceX, sourceZ, layerData, params, worm);
+            loopi(worm.count - 1)
+            {
+                const vec &p0 = worm.points[max(i - 1, 0)], &p1 = worm.points[i], &p2 = worm.points[i + 1], &p3 = worm.points[min(i + 2, worm.count - 1)];
+                float reach = max(worm.radius[i], worm.radius[i + 1]) + 0.5f * WORM_STEP;
+                if(min(p1.x, p2.x) - reach >= boxMaxX || max(p1.x, p2.x) + reach <= boxMinX ||
+                   min(p1.z, p2.z) - reach >= boxMaxZ || max(p1.z, p2.z) + reach <= boxMinZ)
+                    continue;
+
+                int steps = max(int(p1.dist(p2)), 1);
+                for(int s = 0; s < steps; ++s)
+                {
+                    float t = float(s) / steps, ease = t * t * (3 - 2 * t);
+                    vec center(catmullRom(p0.x, p1.x, p2.x, p3.x, t), catmullRom(p0.y, p1.y, p2.y, p3.y, t), catmullRom(p0.z, p1.z, p2.z, p3.z, t));
+                    carveBlob(center, worm.radius[i] + (worm.radius[i + 1] - worm.radius[i]) * ease, worm.squash, chunkWorldX, chunkWorldZ, layerData, mask);
+                }
+            }
+            carveBlob(worm.points[worm.count - 1], worm.radius[worm.count - 1], worm.squash, chunkWorldX, chunkWorldZ, layerData, mask);
+        }
+    }
+
+    void CaveCarver::carveChunk(const ChunkCoord &coord, CarveMask &mask) const
+    {
+        loopi(LAYER_SKIES) if(mask.hasLayer(i))
+        {
+            for(int x = coord.x - WORM_RANGE; x <= coord.x + WORM_RANGE; ++x)
+                for(int z = coord.z - WORM_RANGE; z <= coord.z + WORM_RANGE; ++z)
+                    carveWorms(x, z, i, coord, mask);
+        }
+    }
+}
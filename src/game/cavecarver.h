@@ -0,0 +1,47 @@
+#ifndef __CAVECARVER_H__
+#define __CAVECARVER_H__
+
+#include "chunk.h"
+#include "worldlayer.h"
+
+namespace game
+{
+    static const int CARVE_WORDS = WORLD_SKIES_MIN / 32;
+
+    // Voxels a chunk's worm caves open up, one bit per voxel below the skies,
+    // along with the layers (bit n for WorldLayer n) the worms were run for.
+    struct CarveMask
+    {
+        int layers;
+        uint bits[CHUNK_SIZE * CHUNK_SIZE][CARVE_WORDS];
+
+        void reset(int wormLayers)
+        {
+            layers = wormLayers;
+            memset(bits, 0, sizeof(bits));
+        }
+
+        bool hasLayer(int layer) const { return (layers >> layer) & 1; }
+        bool isCarved(int x, int y, int z) const { return (bits[z * CHUNK_SIZE + x][y >> 5] >> (y & 31)) & 1; }
+        void carveSpan(int x, int z, int minY, int maxY);
+    };
+
+    // Tunnels and caverns as Catmull-Rom splines through a random walk of
+    // control points, with the radius eased between points. The worms that
+    // start in a chunk are seeded from its coordinates alone, so every chunk
+    // they run through rebuilds the same ones and carves its own part.
+    class CaveCarver
+    {
+    private:
+        unsigned int seed;
+
+        void carveWorms(int sourceX, int sourceZ, int layer, const ChunkCoord &target, CarveMask &mask) const;
+
+    public:
+        CaveCarver(unsigned int worldSeed) : seed(worldSeed) {}
+
+        void carveChunk(const ChunkCoord &coord, CarveMask &mask) const;
+    };
+}
+
+#endif
@@ -1,64 +1,712 @@
 #include "game.h"
 #include "chunk.h"
+#include "vegetation.h"
 
 namespace game
 {
+    ChunkSection *ChunkSection::uniformSections[BLOCK_COUNT];
+
+    void ChunkSection::init()
+    {
+        for(int i = 0; i < BLOCK_COUNT; ++i)
+        {
+            if(uniformSections[i]) continue;
+            uniformSections[i] = new ChunkSection(Block((BlockType)i));
+            uniformSections[i]->shared = true;
+        }
+    }
+
+    ChunkSection::ChunkSection(const Block &fill) :
+        indices(NULL),
+        bits(0),
+        nonAir(fill.type != BLOCK_AIR ? SECTION_VOLUME : 0),
+        shared(false)
+    {
+        palette.add(fill);
+    }
+
+    ChunkSection::~ChunkSection()
+    {
+        DELETEA(indices);
+    }
+
+    void ChunkSection::setPaletteIndex(int index, int paletteIndex)
+    {
+        int bit = index * bits;
+        uint &word = indices[bit >> 5];
+        uint mask = ((1u << bits) - 1) << (bit & 31);
+        word = (word & ~mask) | ((uint)paletteIndex << (bit & 31));
+    }
+
+    void ChunkSection::repack(int newBits)
+    {
+        uint *newIndices = NULL;
+        if(newBits)
+        {
+            int words = SECTION_VOLUME * newBits / 32;
+            newIndices = new uint[words];
+            memset(newIndices, 0, words * sizeof(uint));
+            if(bits)
+            {
+                for(int i = 0; i < SECTION_VOLUME; ++i)
+                {
+                    int bit = i * newBits;
+                    newIndices[bit >> 5] |= (uint)getPaletteIndex(i) << (bit & 31);
+                }
+            }
+        }
+        DELETEA(indices);
+        indices = newIndices;
+        bits = newBits;
+    }
+
+    int ChunkSection::addPaletteEntry(const Block &block)
+    {
+        if(palette.length() >= (1 << bits))
+        {
+            compact();
+            if(palette.length() >= (1 << bits)) repack(bits ? bits * 2 : 1);
+        }
+        palette.add(block);
+        return palette.length() - 1;
+    }
+
+    bool ChunkSection::setBlock(int index, const Block &block)
+    {
+        ASSERT(!shared);
+        int oldIndex = bits ? getPaletteIndex(index) : 0;
+        const Block &old = palette[oldIndex];
+        if(old == block) return false;
+        if(old.type == BLOCK_AIR) nonAir++;
+        else if(block.type == BLOCK_AIR) nonAir--;
+
+        int newIndex = -1;
+        loopv(palette) if(palette[i] == block) { newIndex = i; break; }
+        if(newIndex < 0) newIndex = addPaletteEntry(block);
+        setPaletteIndex(index, newIndex);
+        return true;
+    }
+
+    // Drops palette entries that are no longer referenced and narrows the index
+    // width to match. Returns true if the section collapsed to a single block.
+    bool ChunkSection::compact()
+    {
+        if(!bits) return true;
+
+        int *remap = new int[palette.length()];
+        memset(remap, 0, palette.length() * sizeof(int));
+        for(int i = 0; i < SECTION_VOLUME; ++i) remap[getPaletteIndex(i)] = 1;
+
+        int used = 0;
+        vector<Block> oldPalette;
+        oldPalette.move(palette);
+        loopv(oldPalette)
+        {
+            if(!remap[i]) { remap[i] = -1; continue; }
+            remap[i] = used++;
+            palette.add(oldPalette[i]);
+        }
+
+        int newBits = 0;
+        while((1 << newBits) < used) newBits = newBits ? newBits * 2 : 1;
+        if(newBits == bits && used == oldPalette.length())
+        {
+            delete[] remap;
+            return false;
+        }
+
+        uint *oldIndices = indices;
+        int oldBits = bits;
+        indices = NULL;
+        bits = newBits;
+        if(newBits)
+        {
+            int words = SECTION_VOLUME * newBits / 32;
+            indices = new uint[words];
+            memset(indices, 0, words * sizeof(uint));
+            for(int i = 0; i < SECTION_VOLUME; ++i)
+            {
+                int oldBit = i * oldBits;
+                int oldIndex = (oldIndices[oldBit >> 5] >> (oldBit & 31)) & ((1 << oldBits) - 1);
+                int bit = i * newBits;
+                indices[bit >> 5] |= (uint)remap[oldIndex] << (bit & 31);
+            }
+        }
+        delete[] oldIndices;
+        delete[] remap;
+        return !newBits;
+    }
+
+    size_t ChunkSection::getMemoryUsage() const
+    {
+        if(shared) return 0;
+        return sizeof(ChunkSection) + palette.capacity() * sizeof(Block) + (bits ? SECTION_VOLUME * bits / 8 : 0);
+    }
+
+    // Bits per index, palette size and entries, then the packed indices.
+    void ChunkSection::save(vector<uchar> &buf) const
+    {
+        buf.add(uchar(bits));
+        buf.add(uchar(palette.length() & 0xFF));
+        buf.add(uchar(palette.length() >> 8));
+        loopv(palette)
+        {
+            buf.add(uchar(palette[i].type));
+            buf.add(palette[i].data);
+        }
+        if(!bits) return;
+        int words = SECTION_VOLUME * bits / 32;
+        uint *dst = (uint *)buf.pad(words * sizeof(uint));
+        memcpy(dst, indices, words * sizeof(uint));
+        lilswap(dst, words);
+    }
+
+    ChunkSection *ChunkSection::load(ucharbuf &p)
+    {
+        int bits = p.get(), count = p.get();
+        count |= p.get() << 8;
+        if(bits > 16 || (bits & (bits - 1)) || count < 1 || count > (1 << bits)) return NULL;
+
+        Block first;
+        first.type = BlockType(p.get());
+        first.data = p.get();
+        if(first.type >= BLOCK_COUNT || p.overread()) return NULL;
+        if(!bits && hasShared(first)) return getShared(first);
+
+        ChunkSection *section = new ChunkSection(first);
+        for(int i = 1; i < count; ++i)
+        {
+            Block &block = section->palette.add();
+            block.type = BlockType(p.get());
+            block.data = p.get();
+            if(block.type >= BLOCK_COUNT) { delete section; return NULL; }
+        }
+        if(bits)
+        {
+            int words = SECTION_VOLUME * bits / 32;
+            section->bits = bits;
+            section->indices = new uint[words];
+            if(p.get((uchar *)section->indices, words * sizeof(uint)) < int(words * sizeof(uint))) { delete section; return NULL; }
+            lilswap(section->indices, words);
+            section->nonAir = 0;
+            for(int i = 0; i < SECTION_VOLUME; ++i)
+            {
+                int index = section->getPaletteIndex(i);
+                if(index >= count) { delete section; return NULL; }
+                if(section->palette[index].type != BLOCK_AIR) section->nonAir++;
+            }
+        }
+        if(p.overread()) { delete section; return NULL; }
+        return section;
+    }
+
+    // Swaps one section's interior faces for a freshly built piece whose indices
+    // start at zero, shifting everything after it. The borders are dropped and
+    // have to be reassembled afterwards.
+    void ChunkMesh::replaceSection(int sectionY, const MeshBuffer &piece)
+    {
+        int totalVertices = sectionVertices[CHUNK_SECTIONS], totalIndices = sectionIndices[CHUNK_SECTIONS];
+        vertices.setsize(totalVertices);
+        indices.setsize(totalIndices);
+
+        int firstVertex = sectionVertices[sectionY], endVertex = sectionVertices[sectionY + 1];
+        int firstIndex = sectionIndices[sectionY], endIndex = sectionIndices[sectionY + 1];
+        int numVerts = piece.vertices.length(), numIdx = piece.indices.length();
+        int vertexDelta = numVerts - (endVertex - firstVertex), indexDelta = numIdx - (endIndex - firstIndex);
+        if(vertexDelta > 0) vertices.pad(vertexDelta);
+        if(indexDelta > 0) indices.pad(indexDelta);
+
+        VoxelVertex *v = vertices.getbuf();
+        memmove(v + endVertex + vertexDelta, v + endVertex, (totalVertices - endVertex) * sizeof(VoxelVertex));
+        memcpy(v + firstVertex, piece.vertices.getbuf(), numVerts * sizeof(VoxelVertex));
+
+        uint *idx = indices.getbuf();
+        memmove(idx + endIndex + indexDelta, idx + endIndex, (totalIndices - endIndex) * sizeof(uint));
+        loopi(numIdx) idx[firstIndex + i] = firstVertex + piece.indices[i];
+        if(vertexDelta) for(int i = firstIndex + numIdx; i < totalIndices + indexDelta; ++i) idx[i] += vertexDelta;
+
+        if(vertexDelta < 0) vertices.setsize(totalVertices + vertexDelta);
+        if(indexDelta < 0) indices.setsize(totalIndices + indexDelta);
+        for(int i = sectionY + 1; i <= CHUNK_SECTIONS; ++i)
+        {
+            sectionVertices[i] += vertexDelta;
+            sectionIndices[i] += indexDelta;
+        }
+        dirtySections[sectionY >> 5] &= ~(1u << (sectionY & 31));
+    }
+
     Chunk::Chunk(ChunkCoord c) :
         coord(c),
+        lod(0),
         generated(false),
-        meshBuilt(false)
+        meshBuilt(false),
+        unsaved(false)
     {
+        ChunkSection *air = ChunkSection::getShared(Block(BLOCK_AIR));
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
+        {
+            sections[i] = air;
+            light[i] = NULL;
+        }
         clear();
     }
 
     Chunk::~Chunk()
     {
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
+        {
+            if(!sections[i]->isShared()) delete sections[i];
+        }
+        clearLight();
         mesh.clear();
     }
 
     void Chunk::clear()
     {
-        for(int i = 0; i < CHUNK_VOLUME; ++i)
-        {
-            blocks[i] = Block(BLOCK_AIR);
-        }
-        for(int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; ++i)
+        ChunkSection *air = ChunkSection::getShared(Block(BLOCK_AIR));
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
         {
-            biomes[i] = BIOME_PLAINS;
+            if(!sections[i]->isShared()) delete sections[i];
+            sections[i] = air;
         }
+        memset(biomes, BIOME_PLAINS, sizeof(biomes));
+        memset(heights, -1, sizeof(heights));
+        clearLight();
         mesh.clear();
         mesh.needsRebuild = true;
+        lod = 0;
         generated = false;
         meshBuilt = false;
+        unsaved = false;
     }
 
-    Block Chunk::getBlock(int x, int y, int z) const
+    void Chunk::reset(const ChunkCoord &c)
     {
-        if(!isValidCoord(x, y, z)) return Block(BLOCK_AIR);
-        return blocks[toIndex(x, y, z)];
+        coord = c;
+        clear();
+    }
+
+    void Chunk::save(vector<uchar> &buf) const
+    {
+        buf.put(biomes, CHUNK_SIZE * CHUNK_SIZE);
+        for(int i = 0; i < CHUNK_SECTIONS; ++i) sections[i]->save(buf);
+    }
+
+    // Replaces the contents with a payload written by save(); on a truncated or
+    // inconsistent payload the chunk is left empty and false is returned.
+    bool Chunk::load(const uchar *buf, int len)
+    {
+        clear();
+        ucharbuf p((uchar *)buf, len);
+        for(int i = 0; i < CHUNK_SIZE * CHUNK_SIZE; ++i)
+        {
+            int biome = p.get();
+            if(biome >= BIOME_COUNT) { clear(); return false; }
+            biomes[i] = uchar(biome);
+        }
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
+        {
+            ChunkSection *section = ChunkSection::load(p);
+            if(!section) { clear(); return false; }
+            sections[i] = section;
+        }
+        computeHeights();
+        generated = true;
+        return true;
     }
 
     void Chunk::setBlock(int x, int y, int z, Block block)
     {
-        if(!isValidCoord(x, y, z)) return;
-        blocks[toIndex(x, y, z)] = block;
+        if(writeBlock(x, y, z, block)) updateHeights(x, y, z, block);
+    }
+
+    bool Chunk::writeBlock(int x, int y, int z, const Block &block)
+    {
+        if(!isValidCoord(x, y, z)) return false;
+        ChunkSection *&section = sections[y >> 4];
+        int index = ChunkSection::toIndex(x, y & 15, z);
+        if(section->isShared())
+        {
+            if(section->getBlock(index) == block) return false;
+            section = new ChunkSection(section->getBlock(index));
+        }
+        if(!section->setBlock(index, block)) return false;
+        unsaved = true;
+        if(section->isEmpty())
+        {
+            delete section;
+            section = ChunkSection::getShared(Block(BLOCK_AIR));
+        }
+        return true;
+    }
+
+    // Swaps the whole section for a uniform one instead of writing it block
+    // by block.
+    void Chunk::fillSection(int sectionY, const Block &block)
+    {
+        ChunkSection *&section = sections[sectionY];
+        if(section->isUniform() && section->getBlock(0) == block) return;
+        if(!section->isShared()) delete section;
+        section = ChunkSection::hasShared(block) ? ChunkSection::getShared(block) : new ChunkSection(block);
+        unsaved = true;
     }
 
     void Chunk::setBlock(int x, int y, int z, BlockType type)
     {
         if(!isValidCoord(x, y, z)) return;
-        blocks[toIndex(x, y, z)].type = type;
+        Block block = getBlock(x, y, z);
+        block.type = type;
+        setBlock(x, y, z, block);
+    }
+
+    void Chunk::compact()
+    {
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
+        {
+            ChunkSection *&section = sections[i];
+            if(section->isShared() || !section->compact()) continue;
+            Block block = section->getBlock(0);
+            if(!ChunkSection::hasShared(block)) continue;
+            delete section;
+            section = ChunkSection::getShared(block);
+        }
+    }
+
+    size_t Chunk::getMemoryUsage() const
+    {
+        size_t usage = sizeof(Chunk);
+        for(int i = 0; i < CHUNK_SECTIONS; ++i)
+        {
+            usage += sections[i]->getMemoryUsage();
+            if(light[i]) usage += SECTION_VOLUME;
+        }
+        usage += mesh.getMemoryUsage();
+        return usage;
+    }
+
+    static const uchar lightOpacity[BLOCK_COUNT] =
+    {
+        0,  // air
+        15, // stone
+        15, // dirt
+        15, // grass
+        15, // sand
+        2,  // water
+        15, // wood
+        1,  // leaves
+        15, // snow
+        2,  // ice
+        15, // gravel
+        15, // coal ore
+        15, // iron ore
+        15, // gold ore
+        15, // diamond ore
+        15, // clay
+        15, // bedrock
+        15, // floatstone
+        15, // sky dirt
+        15, // sky grass
+        1,  // vegetation
+        15, // kithgard stone
+        15, // kithgard soil
+        2,  // kithgard water
+        15, // kithgard glowstone
+        15, // kithgard crystal
+        15, // kithgard metal
+        3   // kithgard cloud
+    };
+
+    static const uchar lightEmission[BLOCK_COUNT] =
+    {
+        0,  // air
+        0,  // stone
+        0,  // dirt
+        0,  // grass
+        0,  // sand
+        0,  // water
+        0,  // wood
+        0,  // leaves
+        0,  // snow
+        0,  // ice
+        0,  // gravel
+        0,  // coal ore
+        0,  // iron ore
+        0,  // gold ore
+        0,  // diamond ore
+        0,  // clay
+        0,  // bedrock
+        0,  // floatstone
+        0,  // sky dirt
+        0,  // sky grass
+        0,  // vegetation
+        0,  // kithgard stone
+        0,  // kithgard soil
+        0,  // kithgard water
+        15, // kithgard glowstone
+        10, // kithgard crystal
+        0,  // kithgard metal
+        0   // kithgard cloud
+    };
+
+    int getLightOpacity(const Block &block)
+    {
+        return lightOpacity[block.type];
+    }
+
+    int getLightEmission(const Block &block)
+    {
+        if(block.type == BLOCK_VEGETATION)
+        {
+            return block.data < VEG_COUNT && VegetationManager::getVegetation(VegetationType(block.data)).glows ? 12 : 0;
+        }
+        return lightEmission[block.type];
+    }
+
+    void Chunk::setLight(int x, int y, int z, int value)
+    {
+        if(!isValidCoord(x, y, z)) return;
+        uchar *&l = light[y >> 4];
+        if(!l)
+        {
+            if(value == lightFill[y >> 4]) return;
+            l = new uchar[SECTION_VOLUME];
+            memset(l, lightFill[y >> 4], SECTION_VOLUME);
+        }
+        l[ChunkSection::toIndex(x, y & 15, z)] = uchar(value);
+    }
+
+    void Chunk::clearLight()
+    {
+        for(int i = 0; i < CHUNK_SECTIONS; ++i) DELETEA(light[i]);
+        memset(lightFill, 0, sizeof(lightFill));
+    }
+
+    static inline uint packLightCell(int x, int y, int z) { return x | (z << 4) | (y << 8); }
+
+    // Breadth-first flood of one channel from the queued cells, which must
+    // already hold their light; it stops at the chunk's sides.
+    static void spreadChunkLight(Chunk *chunk, int channel, vector<uint> &queue)
+    {
+        for(int i = 0; i < queue.length(); ++i)
+        {
+            uint cell = queue[i];
+            int x = cell & 15, z = (cell >> 4) & 15, y = cell >> 8;
+            int level = getLightChannel(chunk->getLight(x, y, z), channel);
+            if(level <= 1) continue;
+            loopj(6)
+            {
+                int nx = x + lightSteps[j][0], ny = y + lightSteps[j][1], nz = z + lightSteps[j][2];
+                if(!Chunk::isValidCoord(nx, ny, nz)) continue;
+                int opacity = getLightOpacity(chunk->getBlock(nx, ny, nz));
+                int next = channel == LIGHT_SKY && j == LIGHTSTEP_DOWN && level == MAXLIGHT && !opacity ? MAXLIGHT : level - max(opacity, 1);
+                int current = chunk->getLight(nx, ny, nz);
+                if(next <= getLightChannel(current, channel)) continue;
+                chunk->setLight(nx, ny, nz, setLightChannel(current, channel, next));
+                queue.add(packLightCell(nx, ny, nz));
+            }
+        }
+        queue.setsize(0);
+    }
+
+    // Lights the chunk on its own, as if it were surrounded by darkness; light
+    // crossing into and out of neighbouring chunks is filled in once they are
+    // all loaded. Sky light falls straight down at full strength to the first
+    // block that isn't clear in each column and fades through translucent ones
+    // below it, then both channels are flooded outwards.
+    void Chunk::computeLight()
+    {
+        clearLight();
+
+        int topSection = CHUNK_SECTIONS - 1;
+        while(topSection >= 0 && sections[topSection]->isEmpty()) topSection--;
+        for(int i = topSection + 1; i < CHUNK_SECTIONS; ++i) lightFill[i] = SKYLIGHT;
+
+        int tops[CHUNK_SIZE * CHUNK_SIZE], lows[CHUNK_SIZE * CHUNK_SIZE];
+        loopi(CHUNK_SIZE * CHUNK_SIZE)
+        {
+            int x = i & 15, z = i >> 4, y = (topSection + 1) * CHUNK_SIZE - 1;
+            for(; y >= 0 && !getLightOpacity(getBlock(x, y, z)); --y) setLight(x, y, z, SKYLIGHT);
+            tops[i] = y + 1;
+            for(int level = MAXLIGHT; y >= 0; --y)
+            {
+                level -= max(getLightOpacity(getBlock(x, y, z)), 1);
+                if(level <= 0) break;
+                setLight(x, y, z, level << 4);
+            }
+            lows[i] = y + 1;
+        }
+
+        // Only cells below the top of a neighbouring column can light anything
+        // the straight fall didn't reach.
+        vector<uint> queue;
+        loopi(CHUNK_SIZE * CHUNK_SIZE)
+        {
+            int x = i & 15, z = i >> 4, reach = 0;
+            if(x > 0) reach = max(reach, tops[i - 1]);
+            if(x < CHUNK_SIZE - 1) reach = max(reach, tops[i + 1]);
+            if(z > 0) reach = max(reach, tops[i - CHUNK_SIZE]);
+            if(z < CHUNK_SIZE - 1) reach = max(reach, tops[i + CHUNK_SIZE]);
+            for(int y = lows[i]; y < reach; ++y) if((getLight(x, y, z) >> 4) > 1) queue.add(packLightCell(x, y, z));
+        }
+        spreadChunkLight(this, LIGHT_SKY, queue);
+
+        for(int sy = 0; sy <= topSection; ++sy)
+        {
+            const vector<Block> &palette = sections[sy]->getPalette();
+            bool emits = false;
+            loopv(palette) if(getLightEmission(palette[i])) { emits = true; break; }
+            if(!emits) continue;
+            for(int y = sy * CHUNK_SIZE; y < (sy + 1) * CHUNK_SIZE; ++y) loopi(CHUNK_SIZE * CHUNK_SIZE)
+            {
+                int x = i & 15, z = i >> 4, emission = getLightEmission(getBlock(x, y, z));
+                if(!emission) continue;
+                setLight(x, y, z, setLightChannel(getLight(x, y, z), LIGHT_BLOCK, emission));
+                queue.add(packLightCell(x, y, z));
+            }
+        }
+        spreadChunkLight(this, LIGHT_BLOCK, queue);
+    }
+
+    bool isHeightBlock(const Block &block, int map)
+    {
+        if(map == HEIGHTMAP_OPAQUE) return getLightOpacity(block) >= MAXLIGHT;
+        switch(block.type)
+        {
+            case BLOCK_AIR:
+            case BLOCK_WATER:
+            case BLOCK_KITHGARD_WATER:
+            case BLOCK_VEGETATION:
+                return false;
+            default:
+                return true;
+        }
+    }
+
+    static const int layerFloors[LAYER_COUNT + 1] = { WORLD_KITHGARD_MIN, WORLD_CAVES_MIN, WORLD_SURFACE_MIN, WORLD_SKIES_MIN, CHUNK_HEIGHT };
+
+    // Walks down one column, skipping whole sections whose palette holds
+    // nothing of the kind.
+    int Chunk::findHeight(int x, int z, int map, int fromY, int minY) const
+    {
+        for(int y = fromY; y >= minY;)
+        {
+            const ChunkSection *section = sections[y >> 4];
+            bool found = false;
+            const vector<Block> &palette = section->getPalette();
+            loopv(palette) if(isHeightBlock(palette[i], map)) { found = true; break; }
+            if(!found)
+            {
+                y = (y & ~15) - 1;
+                continue;
+            }
+            for(int end = max(y & ~15, minY); y >= end; --y)
+            {
+                if(isHeightBlock(section->getBlock(ChunkSection::toIndex(x, y & 15, z)), map)) return y;
+            }
+        }
+        return -1;
+    }
+
+    // A new block can only raise a column; removing its top block means
+    // looking further down for the next one, but never past the layer.
+    void Chunk::updateHeights(int x, int y, int z, const Block &block)
+    {
+        int layer = WorldLayerManager::getWorldLayer(y);
+        loopi(HEIGHTMAP_COUNT)
+        {
+            short &height = heights[i][layer][z * CHUNK_SIZE + x];
+            if(isHeightBlock(block, i))
+            {
+                if(y > height) height = y;
+            }
+            else if(y == height) height = findHeight(x, z, i, y - 1, layerFloors[layer]);
+        }
+    }
+
+    void Chunk::computeHeights()
+    {
+        computeHeights(0, 0, CHUNK_SIZE - 1, CHUNK_SIZE - 1);
+    }
+
+    void Chunk::computeHeights(int minX, int minZ, int maxX, int maxZ)
+    {
+        for(int z = minZ; z <= maxZ; ++z) for(int x = minX; x <= maxX; ++x)
+        {
+            loopi(HEIGHTMAP_COUNT) loopj(LAYER_COUNT) heights[i][j][z * CHUNK_SIZE + x] = findHeight(x, z, i, layerFloors[j + 1] - 1, layerFloors[j]);
+        }
+    }
+
+    int Chunk::getHeight(int x, int z, int map) const
+    {
+        if(x < 0 || x >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE) return -1;
+        for(int i = LAYER_COUNT - 1; i >= 0; --i)
+        {
+            int height = heights[map][i][z * CHUNK_SIZE + x];
+            if(height >= 0) return height;
+        }
+        return -1;
+    }
+
+    int Chunk::getHeight(int x, int z, int map, WorldLayer layer) const
+    {
+        if(x < 0 || x >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE) return -1;
+        return heights[map][layer][z * CHUNK_SIZE + x];
     }
 
     BiomeType Chunk::getBiome(int x, int z) const
     {
         if(x < 0 || x >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE) return BIOME_PLAINS;
-        return biomes[z * CHUNK_SIZE + x];
+        return BiomeType(biomes[z * CHUNK_SIZE + x]);
     }
 
     void Chunk::setBiome(int x, int z, BiomeType biome)
     {
         if(x < 0 || x >= CHUNK_SIZE || z < 0 || z >= CHUNK_SIZE) return;
-        biomes[z * CHUNK_SIZE + x] = biome;
+        biomes[z * CHUNK_SIZE + x] = uchar(biome);
+    }
+
+    ChunkPool::ChunkPool(int capacity) : capacity(capacity), allocated(0), reused(0), mutex(SDL_CreateMutex())
+    {
+    }
+
+    ChunkPool::~ChunkPool()
+    {
+        freeChunks.deletecontents();
+        SDL_DestroyMutex(mutex);
+    }
+
+    Chunk *ChunkPool::alloc(const ChunkCoord &coord)
+    {
+        SDL_LockMutex(mutex);
+        Chunk *chunk = freeChunks.empty() ? NULL : freeChunks.pop();
+        if(chunk) reused++;
+        else allocated++;
+        SDL_UnlockMutex(mutex);
+
+        if(!chunk) return new Chunk(coord);
+        chunk->reset(coord);
+        return chunk;
+    }
+
+    // Sections are freed right away; only the chunk and its mesh vectors are kept.
+    void ChunkPool::release(Chunk *chunk)
+    {
+        chunk->clear();
+        SDL_LockMutex(mutex);
+        if(freeChunks.length() < capacity)
+        {
+            freeChunks.add(chunk);
+            chunk = NULL;
+        }
+        SDL_UnlockMutex(mutex);
+        delete chunk;
+    }
+
+    void ChunkPool::setCapacity(int n)
+    {
+        SDL_LockMutex(mutex);
+        capacity = n;
+        while(freeChunks.length() > capacity) delete freeChunks.pop();
+        SDL_UnlockMutex(mutex);
     }
 }
@@ -3,12 +3,18 @@
 
 #include "cube.h"
 #include "biome.h"
+#include "worldlayer.h"
 
 namespace game
 {
     static const int CHUNK_SIZE = 16;
     static const int CHUNK_HEIGHT = 2048;
     static const int CHUNK_VOLUME = CHUNK_SIZE * CHUNK_SIZE * CHUNK_HEIGHT;
+    static const int CHUNK_SECTIONS = CHUNK_HEIGHT / CHUNK_SIZE;
+    static const int SECTION_VOLUME = CHUNK_SIZE * CHUNK_SIZE * CHUNK_SIZE;
+    static const int MAXLIGHT = 15;
+    static const int SKYLIGHT = MAXLIGHT << 4;
+    static const int MAXCHUNKLOD = 3;
 
     enum BlockType
     {
@@ -50,8 +56,107 @@ namespace game
 
         Block() : type(BLOCK_AIR), data(0) {}
         Block(BlockType t) : type(t), data(0) {}
+
+        bool operator==(const Block &other) const { return type == other.type && data == other.data; }
+        bool operator!=(const Block &other) const { return type != other.type || data != other.data; }
+    };
+
+    // Light is stored as one byte per block: sky light in the high nibble and
+    // block light in the low one. Every step through a block costs its opacity,
+    // and at least one, except full sky light going straight down through
+    // clear blocks.
+    enum
+    {
+        LIGHT_SKY = 0,
+        LIGHT_BLOCK,
+        LIGHT_CHANNELS
     };
 
+    static const int lightSteps[6][3] = { { 0, 1, 0 }, { 0, -1, 0 }, { -1, 0, 0 }, { 1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+    static const int LIGHTSTEP_DOWN = 1;
+
+    extern int getLightOpacity(const Block &block);
+    extern int getLightEmission(const Block &block);
+
+    static inline int getLightChannel(int light, int channel) { return channel == LIGHT_SKY ? light >> 4 : light & 15; }
+    static inline int setLightChannel(int light, int channel, int level) { return channel == LIGHT_SKY ? (light & 15) | (level << 4) : (light & 0xF0) | level; }
+
+    // Each chunk keeps, for every column and world layer, the Y of the highest
+    // block of each kind below, or -1 if the layer has none. Solid blocks are
+    // anything a body can rest on: everything but air, liquids and vegetation.
+    // Opaque blocks stop light outright.
+    enum
+    {
+        HEIGHTMAP_SOLID = 0,
+        HEIGHTMAP_OPAQUE,
+        HEIGHTMAP_COUNT
+    };
+
+    extern bool isHeightBlock(const Block &block, int map);
+
+    // 16x16x16 slice of a chunk column, stored as a palette of distinct blocks plus
+    // bit-packed palette indices. Uniform sections keep no index storage at all, and
+    // the uniform sections for plain block types are shared sentinels owned by the
+    // section table that must never be written through.
+    class ChunkSection
+    {
+    private:
+        vector<Block> palette;
+        uint *indices;
+        int bits;
+        int nonAir;
+        bool shared;
+
+        static ChunkSection *uniformSections[BLOCK_COUNT];
+
+        int getPaletteIndex(int index) const;
+        void setPaletteIndex(int index, int paletteIndex);
+        int addPaletteEntry(const Block &block);
+        void repack(int newBits);
+
+    public:
+        ChunkSection(const Block &fill);
+        ~ChunkSection();
+
+        bool isShared() const { return shared; }
+        bool isUniform() const { return bits == 0; }
+        bool isEmpty() const { return nonAir == 0; }
+        int getNonAirCount() const { return nonAir; }
+        int getPaletteSize() const { return palette.length(); }
+        int getBitsPerBlock() const { return bits; }
+        const vector<Block> &getPalette() const { return palette; }
+
+        Block getBlock(int index) const;
+        bool setBlock(int index, const Block &block);
+        bool compact();
+        size_t getMemoryUsage() const;
+
+        void save(vector<uchar> &buf) const;
+        static ChunkSection *load(ucharbuf &p);
+
+        static int toIndex(int x, int y, int z) { return (y << 8) | (z << 4) | x; }
+
+        static void init();
+        static ChunkSection *getShared(const Block &block);
+        static bool hasShared(const Block &block) { return block.data == 0; }
+    };
+
+    inline int ChunkSection::getPaletteIndex(int index) const
+    {
+        int bit = index * bits;
+        return (indices[bit >> 5] >> (bit & 31)) & ((1 << bits) - 1);
+    }
+
+    inline Block ChunkSection::getBlock(int index) const
+    {
+        return bits ? palette[getPaletteIndex(index)] : palette[0];
+    }
+
+    inline ChunkSection *ChunkSection::getShared(const Block &block)
+    {
+        return uniformSections[block.type];
+    }
+
     struct ChunkCoord
     {
         int x, z;
@@ -79,22 +184,143 @@ namespace game
         }
     };
 
-    struct ChunkMesh
+    enum
+    {
+        FACE_TOP = 0,
+        FACE_BOTTOM,
+        FACE_LEFT,
+        FACE_RIGHT,
+        FACE_FRONT,
+        FACE_BACK,
+        FACE_COUNT,
+        FACE_SMOOTH = 7
+    };
+
+    // Chunk-local corner position with the face index and block type packed into
+    // the fourth component; the shader rebuilds normal and colour from it.
+    // info packs the face (bits 0-2), block type (bits 3-7) and the light of the
+    // cell the face looks into (bits 8-15, block light below sky light).
+    // FACE_SMOOTH vertices come from the smooth terrain mesher and sit anywhere
+    // on the chunk: x and z hold the position in 1/128ths of a block in their
+    // low 12 bits and a 4-bit half of an octahedral normal above that, and y
+    // holds the height in 1/16ths.
+    struct VoxelVertex
+    {
+        ushort x, y, z, info;
+
+        VoxelVertex() {}
+        VoxelVertex(int x, int y, int z, int face, int type, int light) : x(x), y(y), z(z), info(ushort(face | (type << 3) | (light << 8))) {}
+
+        int getFace() const { return info & 7; }
+        int getType() const { return (info >> 3) & 31; }
+        int getLight() const { return info >> 8; }
+
+        static VoxelVertex smooth(const vec &pos, const vec &normal, int type, int light)
+        {
+            float l1 = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+            float u = l1 > 0 ? normal.x / l1 : 0, v = l1 > 0 ? normal.z / l1 : 0;
+            if(normal.y < 0)
+            {
+                float fu = (1 - fabs(v)) * (u < 0 ? -1 : 1), fv = (1 - fabs(u)) * (v < 0 ? -1 : 1);
+                u = fu;
+                v = fv;
+            }
+            int nu = clamp(int((u + 1) * 7.5f + 0.5f), 0, 15), nv = clamp(int((v + 1) * 7.5f + 0.5f), 0, 15);
+            int px = clamp(int(pos.x * 128 + 0.5f), 0, 0xFFF), pz = clamp(int(pos.z * 128 + 0.5f), 0, 0xFFF);
+            int py = clamp(int(pos.y * 16 + 0.5f), 0, 0xFFFF);
+            return VoxelVertex(px | (nu << 12), py, pz | (nv << 12), FACE_SMOOTH, type, light);
+        }
+    };
+
+    enum
     {
-        vector<vec> vertices;
-        vector<vec> normals;
-        vector<vec2> texcoords;
-        vector<unsigned int> indices;
-        bool needsRebuild;
+        CHUNK_SIDE_XNEG = 0,
+        CHUNK_SIDE_XPOS,
+        CHUNK_SIDE_ZNEG,
+        CHUNK_SIDE_ZPOS,
+        CHUNK_SIDES,
+        CHUNK_CORNER_XNEG_ZNEG = CHUNK_SIDES,
+        CHUNK_CORNER_XPOS_ZNEG,
+        CHUNK_CORNER_XNEG_ZPOS,
+        CHUNK_CORNER_XPOS_ZPOS,
+        CHUNK_NEIGHBOURS
+    };
 
-        ChunkMesh() : needsRebuild(true) {}
+    struct MeshBuffer
+    {
+        vector<VoxelVertex> vertices;
+        vector<uint> indices;
 
         void clear()
         {
-            vertices.shrink(0);
-            normals.shrink(0);
-            texcoords.shrink(0);
-            indices.shrink(0);
+            vertices.setsize(0);
+            indices.setsize(0);
+        }
+    };
+
+    // vertices/indices hold what gets drawn: the interior faces of each section
+    // in order, followed by the faces on each of the four chunk sides. Section
+    // ranges are tracked so one section can be swapped out after an edit, and
+    // the sides are also kept apart in borders[] so one can be rebuilt when a
+    // neighbour appears or changes without touching the rest of the mesh.
+    struct ChunkMesh : MeshBuffer
+    {
+        MeshBuffer borders[CHUNK_SIDES];
+        int sectionVertices[CHUNK_SECTIONS + 1], sectionIndices[CHUNK_SECTIONS + 1];
+        uint dirtySections[CHUNK_SECTIONS / 32];
+        int dirtyBorders;
+        GLuint vbo, ebo;
+        int numVertices, numIndices;
+        bool needsRebuild, needsUpload, rebuildAll;
+
+        ChunkMesh() : dirtyBorders(0), vbo(0), ebo(0), numVertices(0), numIndices(0), needsRebuild(true), needsUpload(false), rebuildAll(false)
+        {
+            memset(sectionVertices, 0, sizeof(sectionVertices));
+            memset(sectionIndices, 0, sizeof(sectionIndices));
+            memset(dirtySections, 0, sizeof(dirtySections));
+        }
+
+        void clear()
+        {
+            MeshBuffer::clear();
+            loopi(CHUNK_SIDES) borders[i].clear();
+            memset(sectionVertices, 0, sizeof(sectionVertices));
+            memset(sectionIndices, 0, sizeof(sectionIndices));
+            memset(dirtySections, 0, sizeof(dirtySections));
+            dirtyBorders = 0;
+            rebuildAll = false;
+            needsUpload = true;
+        }
+
+        void markSectionDirty(int sectionY) { dirtySections[sectionY >> 5] |= 1u << (sectionY & 31); }
+        bool isSectionDirty(int sectionY) const { return (dirtySections[sectionY >> 5] >> (sectionY & 31)) & 1; }
+        bool hasDirtySections() const
+        {
+            loopi(CHUNK_SECTIONS / 32) if(dirtySections[i]) return true;
+            return false;
+        }
+
+        void replaceSection(int sectionY, const MeshBuffer &piece);
+
+        void assembleBorders()
+        {
+            vertices.setsize(sectionVertices[CHUNK_SECTIONS]);
+            indices.setsize(sectionIndices[CHUNK_SECTIONS]);
+            loopi(CHUNK_SIDES)
+            {
+                const MeshBuffer &border = borders[i];
+                uint base = vertices.length();
+                vertices.put(border.vertices.getbuf(), border.vertices.length());
+                loopvj(border.indices) indices.add(base + border.indices[j]);
+            }
+            needsUpload = true;
+        }
+
+        size_t getMemoryUsage() const
+        {
+            size_t usage = vertices.capacity() * sizeof(VoxelVertex) + indices.capacity() * sizeof(uint);
+            loopi(CHUNK_SIDES) usage += borders[i].vertices.capacity() * sizeof(VoxelVertex) + borders[i].indices.capacity() * sizeof(uint);
+            return usage;
         }
     };
 
@@ -102,11 +328,19 @@ namespace game
     {
     private:
         ChunkCoord coord;
-        Block blocks[CHUNK_VOLUME];
-        BiomeType biomes[CHUNK_SIZE * CHUNK_SIZE];
+        ChunkSection *sections[CHUNK_SECTIONS];
+        uchar *light[CHUNK_SECTIONS];
+        uchar lightFill[CHUNK_SECTIONS];
+        uchar biomes[CHUNK_SIZE * CHUNK_SIZE];
+        short heights[HEIGHTMAP_COUNT][LAYER_COUNT][CHUNK_SIZE * CHUNK_SIZE];
         ChunkMesh mesh;
+        int lod;
         bool generated;
         bool meshBuilt;
+        bool unsaved;
+
+        int findHeight(int x, int z, int map, int fromY, int minY) const;
+        void updateHeights(int x, int y, int z, const Block &block);
 
     public:
         Chunk(ChunkCoord c);
@@ -115,27 +349,89 @@ namespace game
         ChunkCoord getCoord() const { return coord; }
         bool isGenerated() const { return generated; }
         bool isMeshBuilt() const { return meshBuilt; }
+        bool needsMeshUpdate() const { return !meshBuilt || mesh.rebuildAll || mesh.dirtyBorders || mesh.hasDirtySections(); }
+        bool needsSave() const { return unsaved; }
+        int getLod() const { return lod; }
+        void setLod(int level) { if(level == lod) return; lod = level; markMeshDirty(); }
 
         Block getBlock(int x, int y, int z) const;
         void setBlock(int x, int y, int z, Block block);
         void setBlock(int x, int y, int z, BlockType type);
+        // Bulk edits write through these, which leave the heightmap alone, and
+        // recompute it once for the columns they touched.
+        bool writeBlock(int x, int y, int z, const Block &block);
+        void fillSection(int sectionY, const Block &block);
+
+        const ChunkSection *getSection(int sectionY) const { return sections[sectionY]; }
+
+        int getLight(int x, int y, int z) const;
+        void setLight(int x, int y, int z, int value);
+        bool hasUniformLight(int sectionY) const { return !light[sectionY]; }
+        int getUniformLight(int sectionY) const { return lightFill[sectionY]; }
+        void clearLight();
+        void computeLight();
+
+        int getHeight(int x, int z, int map) const;
+        int getHeight(int x, int z, int map, WorldLayer layer) const;
+        void computeHeights();
+        void computeHeights(int minX, int minZ, int maxX, int maxZ);
+
+        void compact();
+        size_t getMemoryUsage() const;
 
         BiomeType getBiome(int x, int z) const;
         void setBiome(int x, int z, BiomeType biome);
 
-        void markGenerated() { generated = true; }
+        void markGenerated() { generated = true; unsaved = true; }
+        void markSaved() { unsaved = false; }
         void markMeshDirty() { mesh.needsRebuild = true; meshBuilt = false; }
         void markMeshBuilt() { meshBuilt = true; mesh.needsRebuild = false; }
+        void markBorderDirty(int side) { mesh.dirtyBorders |= 1 << side; }
+        // Redoes the whole mesh in place on the next update, for meshes that
+        // can't be patched by section or side; unlike markMeshDirty the old
+        // mesh is kept until then.
+        void markMeshRebuild() { mesh.rebuildAll = true; }
+        void markSectionDirty(int sectionY) { if(sectionY >= 0 && sectionY < CHUNK_SECTIONS) mesh.markSectionDirty(sectionY); }
 
         ChunkMesh& getMesh() { return mesh; }
         const ChunkMesh& getMesh() const { return mesh; }
 
         void clear();
+        void reset(const ChunkCoord &c);
+
+        void save(vector<uchar> &buf) const;
+        bool load(const uchar *buf, int len);
 
         static int toIndex(int x, int y, int z);
         static bool isValidCoord(int x, int y, int z);
     };
 
+    // Keeps released chunks for reuse, up to a fixed number, so streaming doesn't
+    // churn chunk objects and their mesh buffers through the allocator; a reused
+    // chunk keeps the capacity of its mesh vectors. Chunks may be released from
+    // any thread.
+    class ChunkPool
+    {
+    private:
+        vector<Chunk *> freeChunks;
+        int capacity;
+        int allocated, reused;
+        SDL_mutex *mutex;
+
+    public:
+        ChunkPool(int capacity);
+        ~ChunkPool();
+
+        Chunk *alloc(const ChunkCoord &coord);
+        void release(Chunk *chunk);
+        void setCapacity(int n);
+
+        int getCapacity() const { return capacity; }
+        int getFreeCount() const { return freeChunks.length(); }
+        int getAllocatedCount() const { return allocated; }
+        int getReusedCount() const { return reused; }
+    };
+
     inline int Chunk::toIndex(int x, int y, int z)
     {
         return y * CHUNK_SIZE * CHUNK_SIZE + z * CHUNK_SIZE + x;
@@ -148,6 +444,20 @@ namespace game
                z >= 0 && z < CHUNK_SIZE;
     }
 
+    inline Block Chunk::getBlock(int x, int y, int z) const
+    {
+        if(!isValidCoord(x, y, z)) return Block(BLOCK_AIR);
+        return sections[y >> 4]->getBlock(ChunkSection::toIndex(x, y & 15, z));
+    }
+
+    // Above the world is open sky; below it, and beside the chunk, is dark.
+    inline int Chunk::getLight(int x, int y, int z) const
+    {
+        if(!isValidCoord(x, y, z)) return y >= CHUNK_HEIGHT ? SKYLIGHT : 0;
+        const uchar *l = light[y >> 4];
+        return l ? l[ChunkSection::toIndex(x, y & 15, z)] : lightFill[y >> 4];
+    }
+
     inline uint hthash(const ChunkCoord &coord)
     {
         return coord.hash();
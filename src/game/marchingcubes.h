@@ -26,8 +26,17 @@ namespace game
         static vec interpolate(double isolevel, const vec &p1, const vec &p2, double v1, double v2);
 
     public:
+        // Corner positions of a unit cell and the corners each edge joins, in
+        // the order the tables use.
+        static const int cornerOffsets[8][3];
+        static const int edgeCorners[12][2];
+
         static void polygonize(const GridCell &cell, double isolevel, vector<Triangle> &triangles);
         static vec calculateNormal(const vec &v0, const vec &v1, const vec &v2);
+
+        static int getCubeIndex(const float *values, float isolevel);
+        static int getEdgeMask(int cubeIndex) { return edgeTable[cubeIndex]; }
+        static const int *getTriangles(int cubeIndex) { return triTable[cubeIndex]; }
     };
 }
 
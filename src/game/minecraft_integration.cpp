@@ -27,13 +27,28 @@ namespace game
         "gold_ore",
         "diamond_ore",
         "clay",
-        "bedrock"
+        "bedrock",
+        "floatstone",
+        "sky_dirt",
+        "sky_grass",
+        "vegetation",
+        "kithgard_stone",
+        "kithgard_soil",
+        "kithgard_water",
+        "kithgard_glowstone",
+        "kithgard_crystal",
+        "kithgard_metal",
+        "kithgard_cloud"
     };
+    static_assert(sizeof(blockNames)/sizeof(blockNames[0]) == BLOCK_COUNT, "blockNames must name every BlockType");
+
+    VARFP(greedymesh, 0, 1, 1, { if(voxelWorld) voxelWorld->markAllMeshesDirty(); });
+    VARFP(smoothterrain, 0, 0, 1, { if(voxelWorld) voxelWorld->markAllMeshesDirty(); });
 
     void initMinecraftWorld(unsigned int seed)
     {
         if(voxelWorld) return;
-        voxelWorld = new VoxelWorld(seed, 6);
+        voxelWorld = new VoxelWorld(seed, chunkdistance);
     }
 
     void shutdownMinecraftWorld()
@@ -112,16 +127,144 @@ namespace game
         breakBlock(x ? *x : 0, y ? *y : 0, z ? *z : 0);
     }
 
+    // Bulk edits are applied in one go on the main thread, so the size of a
+    // region edited from the console is capped.
+    static const int MAXEDITVOLUME = 1 << 22;
+    static BlockTemplate editTemplate;
+
+    static bool checkEditVolume(int x1, int y1, int z1, int x2, int y2, int z2)
+    {
+        llong volume = llong(abs(x2 - x1) + 1) * (abs(y2 - y1) + 1) * (abs(z2 - z1) + 1);
+        if(volume <= MAXEDITVOLUME) return true;
+        conoutf(CON_ERROR, "region of %lld blocks is too large (at most %d)", volume, MAXEDITVOLUME);
+        return false;
+    }
+
+    static inline BlockType getEditType(int type)
+    {
+        return BlockType(clamp(type, 0, BLOCK_COUNT - 1));
+    }
+
+    void cmdMinecraftFillBox(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *blockType)
+    {
+        if(!voxelWorld) initMinecraftWorld();
+        if(!checkEditVolume(*x1, *y1, *z1, *x2, *y2, *z2)) return;
+        int changed = voxelWorld->fillBox(*x1, *y1, *z1, *x2, *y2, *z2, Block(getEditType(*blockType)));
+        conoutf("filled box with %s, %d blocks changed", getBlockName(getEditType(*blockType)), changed);
+    }
+
+    void cmdMinecraftReplaceBox(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *fromType, int *toType)
+    {
+        if(!voxelWorld) initMinecraftWorld();
+        if(!checkEditVolume(*x1, *y1, *z1, *x2, *y2, *z2)) return;
+        int changed = voxelWorld->replaceBox(*x1, *y1, *z1, *x2, *y2, *z2, getEditType(*fromType), Block(getEditType(*toType)));
+        conoutf("replaced %s with %s, %d blocks changed", getBlockName(getEditType(*fromType)), getBlockName(getEditType(*toType)), changed);
+    }
+
+    void cmdMinecraftFillSphere(int *x, int *y, int *z, int *radius, int *blockType)
+    {
+        if(!voxelWorld) initMinecraftWorld();
+        int r = max(*radius, 0);
+        if(!checkEditVolume(*x - r, *y - r, *z - r, *x + r, *y + r, *z + r)) return;
+        int changed = voxelWorld->fillSphere(*x, *y, *z, r, Block(getEditType(*blockType)));
+        conoutf("filled sphere of radius %d with %s, %d blocks changed", r, getBlockName(getEditType(*blockType)), changed);
+    }
+
+    void cmdMinecraftCopyTemplate(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2)
+    {
+        if(!voxelWorld) initMinecraftWorld();
+        if(!checkEditVolume(*x1, *y1, *z1, *x2, *y2, *z2)) return;
+        int missing = voxelWorld->copyBox(*x1, *y1, *z1, *x2, *y2, *z2, editTemplate);
+        conoutf("copied %dx%dx%d blocks%s", editTemplate.sizeX, editTemplate.sizeY, editTemplate.sizeZ, missing ? " (unloaded chunks copied as air)" : "");
+    }
+
+    void cmdMinecraftPasteTemplate(int *x, int *y, int *z, int *keepAir)
+    {
+        if(!voxelWorld) initMinecraftWorld();
+        if(editTemplate.empty())
+        {
+            conoutf(CON_ERROR, "nothing copied to paste");
+            return;
+        }
+        int changed = voxelWorld->pasteTemplate(*x, *y, *z, editTemplate, !*keepAir);
+        conoutf("pasted %dx%dx%d blocks, %d changed", editTemplate.sizeX, editTemplate.sizeY, editTemplate.sizeZ, changed);
+    }
+
     void cmdMinecraftInfo(int *x, int *y, int *z)
     {
         if(!voxelWorld) initMinecraftWorld();
-        BlockType block = getBlockAt(x ? *x : 0, y ? *y : 0, z ? *z : 0);
-        BiomeType biome = getBiomeAt(x ? *x : 0, z ? *z : 0);
-        conoutf("Position [%d, %d, %d]: block=%s biome=%s", x ? *x : 0, y ? *y : 0, z ? *z : 0, getBlockName(block), BiomeManager::getBiomeName(biome));
+        int wx = x ? *x : 0, wy = y ? *y : 0, wz = z ? *z : 0;
+        Block block;
+        BiomeType biome;
+        if(!voxelWorld->tryGetBlock(wx, wy, wz, block) || !voxelWorld->tryGetBiome(wx, wz, biome))
+        {
+            conoutf("Position [%d, %d, %d]: chunk not loaded", wx, wy, wz);
+            return;
+        }
+        int light = voxelWorld->getLight(wx, wy, wz), top = -1;
+        voxelWorld->tryGetHeight(wx, wz, HEIGHTMAP_SOLID, top);
+        conoutf("Position [%d, %d, %d]: block=%s light=%d/%d biome=%s top=%d", wx, wy, wz, getBlockName(block.type), getLightChannel(light, LIGHT_SKY), getLightChannel(light, LIGHT_BLOCK), BiomeManager::getBiomeName(biome), top);
+    }
+
+    void cmdMinecraftRay(float *x, float *y, float *z, float *dx, float *dy, float *dz, float *maxDist)
+    {
+        static const char * const faceNames[FACE_COUNT] = { "top", "bottom", "left", "right", "front", "back" };
+        if(!voxelWorld) initMinecraftWorld();
+        vec dir(*dx, *dy, *dz);
+        if(dir.iszero())
+        {
+            conoutf(CON_ERROR, "usage: blockray x y z dx dy dz [maxdist]");
+            return;
+        }
+        dir.normalize();
+        float range = *maxDist > 0 ? *maxDist : 256;
+        VoxelRayHit hit;
+        if(!voxelWorld->raycast(vec(*x, *y, *z), dir, range, hit))
+        {
+            if(hit.unloaded) conoutf("Ray: reached an unloaded chunk at %.1f", hit.dist);
+            else conoutf("Ray: no block within %.1f", range);
+            return;
+        }
+        conoutf("Ray: %s at [%d, %d, %d], %s face, distance %.2f", getBlockName(hit.block.type), hit.x, hit.y, hit.z, hit.face >= 0 ? faceNames[hit.face] : "inside", hit.dist);
+    }
+
+    void cmdMinecraftStats()
+    {
+        if(!voxelWorld) { conoutf("Minecraft-like world is not initialized"); return; }
+        VoxelWorldStats stats;
+        voxelWorld->getStats(stats);
+        conoutf("%d chunks (%d pending, %d pooled): %d vertices, %d triangles, %.1f MB", stats.chunks, stats.pending, stats.pooled, stats.vertices, stats.triangles, stats.memory / (1024.0f * 1024.0f));
+        conoutf("  chunks per LOD level: %d full, %d at 2x, %d at 4x, %d at 8x", stats.lods[0], stats.lods[1], stats.lods[2], stats.lods[3]);
+
+        WorldGenStats gen;
+        voxelWorld->getWorldGenerator()->getStats(gen);
+        loopi(LAYER_COUNT)
+        {
+            llong total = gen.evaluated[i] + gen.bulkFilled[i];
+            if(!total) continue;
+            conoutf("  %s: %lld voxels evaluated, %lld bulk filled (%.1f%%)", WorldLayerManager::getLayerData(WorldLayer(i)).name, gen.evaluated[i], gen.bulkFilled[i], 100.0f * gen.bulkFilled[i] / total);
+        }
+        if(gen.chunks)
+        {
+            string times = "";
+            loopi(GENSTAGE_COUNT) concformatstring(times, "%s%s %.2f", i ? ", " : "", genStageNames[i], gen.stageTime[i] / 1e6 / (i == GENSTAGE_MESH ? max(gen.meshes, 1) : gen.chunks));
+            conoutf("  ms per chunk: %s", times);
+        }
+
+        RegionStats regions;
+        voxelWorld->getRegionStore()->getStats(regions);
+        conoutf("regions: %d open, %d chunks loaded (%.1f MB), %d saved (%.1f MB), %d queued", regions.regions, regions.loaded, regions.bytesRead / (1024.0f * 1024.0f), regions.saved, regions.bytesWritten / (1024.0f * 1024.0f), regions.queued);
     }
 
     ICOMMAND(initminecraft, "i", (int *seed), cmdMinecraftInit(seed));
     ICOMMAND(placeblock, "iiii", (int *x, int *y, int *z, int *type), cmdMinecraftPlace(x, y, z, type));
     ICOMMAND(breakblock, "iii", (int *x, int *y, int *z), cmdMinecraftBreak(x, y, z));
+    ICOMMAND(fillbox, "iiiiiii", (int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *type), cmdMinecraftFillBox(x1, y1, z1, x2, y2, z2, type));
+    ICOMMAND(replacebox, "iiiiiiii", (int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *from, int *to), cmdMinecraftReplaceBox(x1, y1, z1, x2, y2, z2, from, to));
+    ICOMMAND(fillsphere, "iiiii", (int *x, int *y, int *z, int *radius, int *type), cmdMinecraftFillSphere(x, y, z, radius, type));
+    ICOMMAND(copytemplate, "iiiiii", (int *x1, int *y1, int *z1, int *x2, int *y2, int *z2), cmdMinecraftCopyTemplate(x1, y1, z1, x2, y2, z2));
+    ICOMMAND(pastetemplate, "iiii", (int *x, int *y, int *z, int *keepair), cmdMinecraftPasteTemplate(x, y, z, keepair));
     ICOMMAND(blockinfo, "iii", (int *x, int *y, int *z), cmdMinecraftInfo(x, y, z));
+    ICOMMAND(blockray, "fffffff", (float *x, float *y, float *z, float *dx, float *dy, float *dz, float *maxdist), cmdMinecraftRay(x, y, z, dx, dy, dz, maxdist));
+    ICOMMAND(voxelstats, "", (), cmdMinecraftStats());
 }
@@ -22,7 +22,14 @@ namespace game
     void cmdMinecraftInit(int *seed);
     void cmdMinecraftPlace(int *x, int *y, int *z, int *blockType);
     void cmdMinecraftBreak(int *x, int *y, int *z);
+    void cmdMinecraftFillBox(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *blockType);
+    void cmdMinecraftReplaceBox(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2, int *fromType, int *toType);
+    void cmdMinecraftFillSphere(int *x, int *y, int *z, int *radius, int *blockType);
+    void cmdMinecraftCopyTemplate(int *x1, int *y1, int *z1, int *x2, int *y2, int *z2);
+    void cmdMinecraftPasteTemplate(int *x, int *y, int *z, int *keepAir);
     void cmdMinecraftInfo(int *x, int *y, int *z);
+    void cmdMinecraftRay(float *x, float *y, float *z, float *dx, float *dy, float *dz, float *maxDist);
+    void cmdMinecraftStats();
 }
 
 #endif
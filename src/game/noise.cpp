@@ -3,6 +3,11 @@
 #include <cmath>
 #include <cstdlib>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define NOISE_SSE2 1
+#include <emmintrin.h>
+#endif
+
 namespace game
 {
     static const int PERMUTATION_COUNT = 256;
@@ -253,6 +258,187 @@ namespace game
         return total / maxValue;
     }
 
+    static const float gradX[12] = { 1, -1, 1, -1, 1, -1, 1, -1, 0, 0, 0, 0 };
+    static const float gradY[12] = { 1, 1, -1, -1, 0, 0, 0, 0, 1, -1, 1, -1 };
+    static const float gradZ[12] = { 0, 0, 0, 0, 1, 1, -1, -1, 1, 1, -1, -1 };
+
+    // Same lattice walk as SimplexNoise::noise, including its floor (which steps
+    // down one extra cell at non-positive integers), so results only differ by
+    // float rounding.
+    static inline int fastfloorf(float x)
+    {
+        return x > 0 ? (int)x : (int)x - 1;
+    }
+
+    static inline float simplexCornerf(const int *perm, int hash, float x, float y, float z)
+    {
+        float t = 0.6f - x*x - y*y - z*z;
+        if(t < 0) return 0.0f;
+        int g = perm[hash] % 12;
+        t *= t;
+        return t * t * (gradX[g]*x + gradY[g]*y + gradZ[g]*z);
+    }
+
+    static float simplexNoisef(const int *perm, float x, float y, float z)
+    {
+        const float F3 = 1.0f/3.0f, G3 = 1.0f/6.0f;
+
+        float s = (x + y + z) * F3;
+        int i = fastfloorf(x + s), j = fastfloorf(y + s), k = fastfloorf(z + s);
+        // Split the unskew offset (i + j + k) / 6 into an integer part and a
+        // small remainder so x0..z0 keep their precision far from the origin.
+        int sum = i + j + k, q = sum / 6;
+        float t = (sum - q * 6) * G3;
+        float x0 = (x - i + q) + t, y0 = (y - j + q) + t, z0 = (z - k + q) + t;
+
+        int i1, j1, k1, i2, j2, k2;
+        if(x0 >= y0)
+        {
+            if(y0 >= z0) { i1=1; j1=0; k1=0; i2=1; j2=1; k2=0; }
+            else if(x0 >= z0) { i1=1; j1=0; k1=0; i2=1; j2=0; k2=1; }
+            else { i1=0; j1=0; k1=1; i2=1; j2=0; k2=1; }
+        }
+        else
+        {
+            if(y0 < z0) { i1=0; j1=0; k1=1; i2=0; j2=1; k2=1; }
+            else if(x0 < z0) { i1=0; j1=1; k1=0; i2=0; j2=1; k2=1; }
+            else { i1=0; j1=1; k1=0; i2=1; j2=1; k2=0; }
+        }
+
+        int ii = i & 255, jj = j & 255, kk = k & 255;
+        float n = simplexCornerf(perm, ii + perm[jj + perm[kk]], x0, y0, z0);
+        n += simplexCornerf(perm, ii + i1 + perm[jj + j1 + perm[kk + k1]], x0 - i1 + G3, y0 - j1 + G3, z0 - k1 + G3);
+        n += simplexCornerf(perm, ii + i2 + perm[jj + j2 + perm[kk + k2]], x0 - i2 + 2*G3, y0 - j2 + 2*G3, z0 - k2 + 2*G3);
+        n += simplexCornerf(perm, ii + 1 + perm[jj + 1 + perm[kk + 1]], x0 - 1 + 3*G3, y0 - 1 + 3*G3, z0 - 1 + 3*G3);
+        return 32.0f * n;
+    }
+
+#ifdef NOISE_SSE2
+    static inline __m128 fastfloorps(__m128 v)
+    {
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(v));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmple_ps(v, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+    }
+
+    static inline __m128 simplexCornerps(__m128 x, __m128 y, __m128 z, const float *g)
+    {
+        __m128 t = _mm_sub_ps(_mm_set1_ps(0.6f), _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        t = _mm_max_ps(t, _mm_setzero_ps());
+        t = _mm_mul_ps(t, t);
+        t = _mm_mul_ps(t, t);
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(g), x), _mm_mul_ps(_mm_loadu_ps(g + 4), y)), _mm_mul_ps(_mm_loadu_ps(g + 8), z));
+        return _mm_mul_ps(t, d);
+    }
+#endif
+
+    void SimplexNoise::noiseBatch(const float *x, const float *y, const float *z, float *out, int count) const
+    {
+        int n = 0;
+#ifdef NOISE_SSE2
+        const __m128 one = _mm_set1_ps(1.0f), allset = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        const __m128 F3 = _mm_set1_ps(1.0f/3.0f), G3 = _mm_set1_ps(1.0f/6.0f);
+        for(; n + 4 <= count; n += 4)
+        {
+            __m128 px = _mm_loadu_ps(x + n), py = y ? _mm_loadu_ps(y + n) : _mm_setzero_ps(), pz = _mm_loadu_ps(z + n);
+            __m128 s = _mm_mul_ps(_mm_add_ps(_mm_add_ps(px, py), pz), F3);
+            __m128 fi = fastfloorps(_mm_add_ps(px, s)), fj = fastfloorps(_mm_add_ps(py, s)), fk = fastfloorps(_mm_add_ps(pz, s));
+            __m128 sum = _mm_add_ps(_mm_add_ps(fi, fj), fk);
+            __m128 q = _mm_cvtepi32_ps(_mm_cvttps_epi32(_mm_mul_ps(sum, G3)));
+            __m128 t = _mm_mul_ps(_mm_sub_ps(sum, _mm_mul_ps(q, _mm_set1_ps(6.0f))), G3);
+            __m128 x0 = _mm_add_ps(_mm_add_ps(_mm_sub_ps(px, fi), q), t);
+            __m128 y0 = _mm_add_ps(_mm_add_ps(_mm_sub_ps(py, fj), q), t);
+            __m128 z0 = _mm_add_ps(_mm_add_ps(_mm_sub_ps(pz, fk), q), t);
+
+            // Branch-free version of the corner ordering table in noise().
+            __m128 xy = _mm_cmpge_ps(x0, y0), yz = _mm_cmpge_ps(y0, z0), xz = _mm_cmpge_ps(x0, z0);
+            __m128 mi1 = _mm_and_ps(xy, xz);
+            __m128 mj1 = _mm_andnot_ps(xy, yz);
+            __m128 mk1 = _mm_andnot_ps(_mm_or_ps(yz, mi1), allset);
+            __m128 mi2 = _mm_or_ps(xy, _mm_and_ps(yz, xz));
+            __m128 mj2 = _mm_or_ps(_mm_andnot_ps(xy, allset), yz);
+            __m128 mk2 = _mm_andnot_ps(_mm_and_ps(yz, xz), allset);
+            __m128 i1 = _mm_and_ps(mi1, one), j1 = _mm_and_ps(mj1, one), k1 = _mm_and_ps(mk1, one);
+            __m128 i2 = _mm_and_ps(mi2, one), j2 = _mm_and_ps(mj2, one), k2 = _mm_and_ps(mk2, one);
+
+            int ci[4], cj[4], ck[4], o1[4], o2[4];
+            _mm_storeu_si128((__m128i *)ci, _mm_cvttps_epi32(fi));
+            _mm_storeu_si128((__m128i *)cj, _mm_cvttps_epi32(fj));
+            _mm_storeu_si128((__m128i *)ck, _mm_cvttps_epi32(fk));
+            _mm_storeu_si128((__m128i *)o1, _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(i1), _mm_slli_epi32(_mm_cvttps_epi32(j1), 1)), _mm_slli_epi32(_mm_cvttps_epi32(k1), 2)));
+            _mm_storeu_si128((__m128i *)o2, _mm_or_si128(_mm_or_si128(_mm_cvttps_epi32(i2), _mm_slli_epi32(_mm_cvttps_epi32(j2), 1)), _mm_slli_epi32(_mm_cvttps_epi32(k2), 2)));
+
+            // No gathers in SSE2, so the permutation lookups stay scalar; the
+            // gradients are laid out as x[4], y[4], z[4] per corner.
+            float g[4][12];
+            for(int l = 0; l < 4; ++l)
+            {
+                int ii = ci[l] & 255, jj = cj[l] & 255, kk = ck[l] & 255;
+                int a1 = o1[l] & 1, b1 = (o1[l] >> 1) & 1, c1 = o1[l] >> 2;
+                int a2 = o2[l] & 1, b2 = (o2[l] >> 1) & 1, c2 = o2[l] >> 2;
+                int h[4] =
+                {
+                    perm[ii + perm[jj + perm[kk]]] % 12,
+                    perm[ii + a1 + perm[jj + b1 + perm[kk + c1]]] % 12,
+                    perm[ii + a2 + perm[jj + b2 + perm[kk + c2]]] % 12,
+                    perm[ii + 1 + perm[jj + 1 + perm[kk + 1]]] % 12
+                };
+                for(int c = 0; c < 4; ++c)
+                {
+                    g[c][l] = gradX[h[c]];
+                    g[c][4 + l] = gradY[h[c]];
+                    g[c][8 + l] = gradZ[h[c]];
+                }
+            }
+
+            __m128 n0 = simplexCornerps(x0, y0, z0, g[0]);
+            n0 = _mm_add_ps(n0, simplexCornerps(_mm_add_ps(_mm_sub_ps(x0, i1), G3), _mm_add_ps(_mm_sub_ps(y0, j1), G3), _mm_add_ps(_mm_sub_ps(z0, k1), G3), g[1]));
+            __m128 G3x2 = _mm_add_ps(G3, G3);
+            n0 = _mm_add_ps(n0, simplexCornerps(_mm_add_ps(_mm_sub_ps(x0, i2), G3x2), _mm_add_ps(_mm_sub_ps(y0, j2), G3x2), _mm_add_ps(_mm_sub_ps(z0, k2), G3x2), g[2]));
+            __m128 G3x3 = _mm_sub_ps(_mm_add_ps(G3x2, G3), one);
+            n0 = _mm_add_ps(n0, simplexCornerps(_mm_add_ps(x0, G3x3), _mm_add_ps(y0, G3x3), _mm_add_ps(z0, G3x3), g[3]));
+            _mm_storeu_ps(out + n, _mm_mul_ps(n0, _mm_set1_ps(32.0f)));
+        }
+#endif
+        for(; n < count; ++n) out[n] = simplexNoisef(perm, x[n], y ? y[n] : 0.0f, z[n]);
+    }
+
+    static const int NOISE_BATCH = 64;
+
+    void SimplexNoise::octaveNoiseBatch(const float *x, const float *y, const float *z, float *out, int count, int octaves, float persistence, float scale) const
+    {
+        float maxValue = 0, amplitude = 1;
+        for(int i = 0; i < octaves; ++i)
+        {
+            maxValue += amplitude;
+            amplitude *= persistence;
+        }
+        float invMax = 1.0f / maxValue;
+
+        float sx[NOISE_BATCH], sy[NOISE_BATCH], sz[NOISE_BATCH], n[NOISE_BATCH];
+        for(int base = 0; base < count; base += NOISE_BATCH)
+        {
+            int num = min(count - base, NOISE_BATCH);
+            float *dst = out + base;
+            memset(dst, 0, num * sizeof(float));
+            float frequency = scale;
+            amplitude = 1;
+            for(int i = 0; i < octaves; ++i)
+            {
+                for(int j = 0; j < num; ++j)
+                {
+                    sx[j] = x[base + j] * frequency;
+                    sy[j] = y ? y[base + j] * frequency : 0.0f;
+                    sz[j] = z[base + j] * frequency;
+                }
+                noiseBatch(sx, sy, sz, n, num);
+                for(int j = 0; j < num; ++j) dst[j] += n[j] * amplitude;
+                amplitude *= persistence;
+                frequency *= 2;
+            }
+            for(int j = 0; j < num; ++j) dst[j] *= invMax;
+        }
+    }
+
     NoiseGenerator::NoiseGenerator(unsigned int seed) :
         continentalness(seed + 1),
         erosion(seed + 2),
@@ -298,9 +484,13 @@ namespace game
 
     double NoiseGenerator::getDensity(double x, double y, double z) const
     {
-        double cont = getContinentalness(x, z);
-        double erosionFactor = getErosion(x, z);
-        double peaks = getPeaksValleys(x, z);
+        return getDensity(x, y, z, getContinentalness(x, z), getErosion(x, z), getPeaksValleys(x, z));
+    }
+
+    // Takes the 2D terms at (x, z) from the caller, so a column can reuse them
+    // for every y instead of re-evaluating three octave noises per voxel.
+    double NoiseGenerator::getDensity(double x, double y, double z, double cont, double erosionFactor, double peaks) const
+    {
         double value = continentalness.octaveNoise(x, y, z, 5, 0.5, 0.001);
         value += peaks * 0.35;
         value -= erosionFactor * 0.2;
@@ -325,4 +515,138 @@ namespace game
     {
         return cave_noise1.octaveNoise(x, y, z, 5, 0.5, 0.02);
     }
+
+    void NoiseGenerator::getContinentalness(const float *x, const float *z, float *out, int count) const
+    {
+        continentalness.octaveNoiseBatch(x, NULL, z, out, count, 6, 0.5f, 0.0015f);
+    }
+
+    void NoiseGenerator::getErosion(const float *x, const float *z, float *out, int count) const
+    {
+        erosion.octaveNoiseBatch(x, NULL, z, out, count, 5, 0.6f, 0.0025f);
+    }
+
+    void NoiseGenerator::getPeaksValleys(const float *x, const float *z, float *out, int count) const
+    {
+        peaks_valleys.octaveNoiseBatch(x, NULL, z, out, count, 5, 0.55f, 0.002f);
+    }
+
+    void NoiseGenerator::getTemperature(const float *x, const float *z, float *out, int count) const
+    {
+        temperature.octaveNoiseBatch(x, NULL, z, out, count, 4, 0.6f, 0.0005f);
+    }
+
+    void NoiseGenerator::getHumidity(const float *x, const float *z, float *out, int count) const
+    {
+        humidity.octaveNoiseBatch(x, NULL, z, out, count, 4, 0.6f, 0.0005f);
+    }
+
+    void NoiseGenerator::getWeirdness(const float *x, const float *z, float *out, int count) const
+    {
+        weirdness.octaveNoiseBatch(x, NULL, z, out, count, 3, 0.5f, 0.002f);
+    }
+
+    // The 2D terms are shared by every point, i.e. the batch is one column.
+    void NoiseGenerator::getDensity(const float *x, const float *y, const float *z, float *out, int count, double cont, double erosionFactor, double peaks) const
+    {
+        continentalness.octaveNoiseBatch(x, y, z, out, count, 5, 0.5f, 0.001f);
+        float offset = float(peaks * 0.35 - erosionFactor * 0.2 + cont * 0.5 + 64.0 * 0.015);
+        for(int i = 0; i < count; ++i) out[i] += offset - y[i] * 0.015f;
+    }
+
+    void NoiseGenerator::getCaveNoise(const float *x, const float *y, const float *z, float *out, int count) const
+    {
+        cave_noise1.octaveNoiseBatch(x, y, z, out, count, 4, 0.6f, 0.01f);
+    }
+
+    void NoiseGenerator::getCaveSpaghetti(const float *x, const float *y, const float *z, float *out, int count) const
+    {
+        float b[NOISE_BATCH];
+        for(int base = 0; base < count; base += NOISE_BATCH)
+        {
+            int num = min(count - base, NOISE_BATCH);
+            cave_noise2.octaveNoiseBatch(x + base, y + base, z + base, out + base, num, 3, 0.7f, 0.03f);
+            cave_noise3.octaveNoiseBatch(x + base, y + base, z + base, b, num, 3, 0.7f, 0.03f);
+            for(int i = 0; i < num; ++i) out[base + i] *= b[i];
+        }
+    }
+
+    void NoiseGenerator::getCaveCheese(const float *x, const float *y, const float *z, float *out, int count) const
+    {
+        cave_noise1.octaveNoiseBatch(x, y, z, out, count, 5, 0.5f, 0.02f);
+    }
+
+    // Octave settings of the NoiseGenerator getters; the 2D ones sample y = 0.
+    static const struct { const char *name; int octaves; float persistence, scale; bool flat; } noiseChecks[] =
+    {
+        { "continentalness", 6, 0.5f, 0.0015f, true },
+        { "erosion", 5, 0.6f, 0.0025f, true },
+        { "peaksvalleys", 5, 0.55f, 0.002f, true },
+        { "temperature", 4, 0.6f, 0.0005f, true },
+        { "weirdness", 3, 0.5f, 0.002f, true },
+        { "density", 5, 0.5f, 0.001f, false },
+        { "cave", 4, 0.6f, 0.01f, false },
+        { "spaghetti", 3, 0.7f, 0.03f, false },
+        { "cheese", 5, 0.5f, 0.02f, false }
+    };
+
+    static void reportNoiseError(const char *name, const vector<double> &expected, const vector<float> &out, Uint32 batchMillis, Uint32 scalarMillis)
+    {
+        double maxError = 0, totalError = 0;
+        loopv(expected)
+        {
+            double error = fabs(expected[i] - out[i]);
+            maxError = max(maxError, error);
+            totalError += error;
+        }
+        conoutf("noise %s: max error %g, mean error %g, batch %d ms, scalar %d ms", name, maxError, totalError / expected.length(), batchMillis, scalarMillis);
+    }
+
+    // Compares the batched float kernels against the double reference, both
+    // the single octave and the octave sums the getters evaluate, over x and z
+    // in +-range and y in +-100.
+    static void noiseCheck(int samples, float range)
+    {
+        int count = samples > 0 ? samples : 100000;
+        if(range <= 0) range = 1000;
+        SimplexNoise ref(12345);
+        vector<float> xs, ys, zs, out;
+        vector<double> expected;
+        loopi(count)
+        {
+            xs.add(rndscale(2*range) - range);
+            ys.add(rndscale(200.0f) - 100.0f);
+            zs.add(rndscale(2*range) - range);
+        }
+        out.pad(count);
+        expected.pad(count);
+        conoutf("noise check: %d samples, x/z in +-%g", count, range);
+
+        Uint32 start = SDL_GetTicks();
+        ref.noiseBatch(xs.getbuf(), ys.getbuf(), zs.getbuf(), out.getbuf(), count);
+        Uint32 batchMillis = SDL_GetTicks() - start;
+
+        start = SDL_GetTicks();
+        loopi(count) expected[i] = ref.noise(xs[i], ys[i], zs[i]);
+        Uint32 scalarMillis = SDL_GetTicks() - start;
+        reportNoiseError("single octave", expected, out, batchMillis, scalarMillis);
+
+        loopj(sizeof(noiseChecks)/sizeof(noiseChecks[0]))
+        {
+            const char *name = noiseChecks[j].name;
+            int octaves = noiseChecks[j].octaves;
+            float persistence = noiseChecks[j].persistence, scale = noiseChecks[j].scale;
+            bool flat = noiseChecks[j].flat;
+
+            start = SDL_GetTicks();
+            ref.octaveNoiseBatch(xs.getbuf(), flat ? NULL : ys.getbuf(), zs.getbuf(), out.getbuf(), count, octaves, persistence, scale);
+            batchMillis = SDL_GetTicks() - start;
+
+            start = SDL_GetTicks();
+            loopi(count) expected[i] = ref.octaveNoise(xs[i], flat ? 0.0 : ys[i], zs[i], octaves, persistence, scale);
+            scalarMillis = SDL_GetTicks() - start;
+            reportNoiseError(name, expected, out, batchMillis, scalarMillis);
+        }
+    }
+    ICOMMAND(noisecheck, "if", (int *samples, float *range), noiseCheck(*samples, *range));
 }
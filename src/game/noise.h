@@ -33,6 +33,11 @@ namespace game
         SimplexNoise(unsigned int seed = 0);
         double noise(double x, double y, double z) const;
         double octaveNoise(double x, double y, double z, int octaves, double persistence, double scale = 1.0) const;
+
+        // Single-precision versions that evaluate count points at once, four per
+        // step with SSE2 where available. A NULL y reads as 0 for 2D fields.
+        void noiseBatch(const float *x, const float *y, const float *z, float *out, int count) const;
+        void octaveNoiseBatch(const float *x, const float *y, const float *z, float *out, int count, int octaves, float persistence, float scale = 1.0f) const;
     };
     
     class NoiseGenerator
@@ -58,9 +63,21 @@ namespace game
         double getHumidity(double x, double z) const;
         double getWeirdness(double x, double z) const;
         double getDensity(double x, double y, double z) const;
+        double getDensity(double x, double y, double z, double cont, double erosionFactor, double peaks) const;
         double getCaveNoise(double x, double y, double z) const;
         double getCaveSpaghetti(double x, double y, double z) const;
         double getCaveCheese(double x, double y, double z) const;
+
+        void getContinentalness(const float *x, const float *z, float *out, int count) const;
+        void getErosion(const float *x, const float *z, float *out, int count) const;
+        void getPeaksValleys(const float *x, const float *z, float *out, int count) const;
+        void getTemperature(const float *x, const float *z, float *out, int count) const;
+        void getHumidity(const float *x, const float *z, float *out, int count) const;
+        void getWeirdness(const float *x, const float *z, float *out, int count) const;
+        void getDensity(const float *x, const float *y, const float *z, float *out, int count, double cont, double erosionFactor, double peaks) const;
+        void getCaveNoise(const float *x, const float *y, const float *z, float *out, int count) const;
+        void getCaveSpaghetti(const float *x, const float *y, const float *z, float *out, int count) const;
+        void getCaveCheese(const float *x, const float *y, const float *z, float *out, int count) const;
     };
 }
 
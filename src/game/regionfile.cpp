@@ -0,0 +1,304 @@
+#include "game.h"
+#include "regionfile.h"
+
+namespace game
+{
+    VARP(voxelsave, 0, 1, 1);
+
+    static const char regionMagic[4] = { 'V', 'X', 'R', 'G' };
+    static const int REGION_HEADER = 8 + REGION_CHUNKS * 2 * sizeof(uint);
+    static const uint MAXCHUNKPAYLOAD = 1 << 24;
+
+    static inline uint sectorAlign(uint len)
+    {
+        return (len + REGION_SECTOR - 1) / REGION_SECTOR * REGION_SECTOR;
+    }
+
+    // findfile only creates missing directories under the home directory.
+    static void createRegionDir(const char *name)
+    {
+        string dir;
+        copystring(dir, findfile(name, "w"));
+        for(char *sep = strchr(dir, PATHDIV); sep; sep = strchr(sep + 1, PATHDIV))
+        {
+            *sep = '\0';
+            if(dir[0] && !fileexists(dir, "d")) createdir(dir);
+            *sep = PATHDIV;
+        }
+    }
+
+    RegionStore::RegionStore(unsigned int seed, ChunkPool *pool) :
+        seed(seed),
+        pool(pool),
+        openRegions(0),
+        useCounter(0),
+        mutex(SDL_CreateMutex()),
+        queueCond(SDL_CreateCond()),
+        doneCond(SDL_CreateCond()),
+        stopping(false)
+    {
+        memset(&stats, 0, sizeof(stats));
+        saver = SDL_CreateThread(runSaver, "region saver", this);
+    }
+
+    RegionStore::~RegionStore()
+    {
+        SDL_LockMutex(mutex);
+        stopping = true;
+        SDL_CondBroadcast(queueCond);
+        SDL_UnlockMutex(mutex);
+        SDL_WaitThread(saver, NULL);
+
+        enumerate(regions, RegionFile *, region, delete region);
+        regions.clear();
+        SDL_DestroyCond(doneCond);
+        SDL_DestroyCond(queueCond);
+        SDL_DestroyMutex(mutex);
+    }
+
+    // Called with the mutex held, from the main thread only.
+    bool RegionStore::openRegion(RegionFile *region, bool create)
+    {
+        defformatstring(name, "voxelworld/%u/r.%d.%d.vxr", seed, region->coord.x, region->coord.z);
+        path(name);
+
+        uint table[2 * REGION_CHUNKS];
+        stream *f = openrawfile(name, "r+b");
+        if(f)
+        {
+            char magic[4];
+            if(f->read(magic, 4) == 4 && !memcmp(magic, regionMagic, 4) && f->getlil<int>() == REGION_VERSION &&
+               f->read(table, sizeof(table)) == sizeof(table))
+            {
+                lilswap(table, 2 * REGION_CHUNKS);
+                region->end = sectorAlign(REGION_HEADER);
+                loopi(REGION_CHUNKS)
+                {
+                    region->offsets[i] = table[2 * i];
+                    region->lengths[i] = table[2 * i + 1];
+                    if(region->lengths[i]) region->end = max(region->end, region->offsets[i] + sectorAlign(region->lengths[i]));
+                }
+                region->file = f;
+                return true;
+            }
+            delete f;
+            conoutf(CON_WARN, "ignoring invalid region file: %s", name);
+        }
+        if(!create) return false;
+
+        createRegionDir(name);
+        f = openrawfile(name, "w+b");
+        if(!f)
+        {
+            conoutf(CON_ERROR, "could not create region file: %s", name);
+            return false;
+        }
+        memset(table, 0, sizeof(table));
+        f->write(regionMagic, 4);
+        f->putlil<int>(REGION_VERSION);
+        f->write(table, sizeof(table));
+        memset(region->offsets, 0, sizeof(region->offsets));
+        memset(region->lengths, 0, sizeof(region->lengths));
+        region->end = sectorAlign(REGION_HEADER);
+        region->file = f;
+        return true;
+    }
+
+    // Called with the mutex held. Closes the least recently used unpinned
+    // regions until the open file count is back under the limit.
+    void RegionStore::evictRegions(RegionFile *keep)
+    {
+        while(openRegions > MAXOPENREGIONS)
+        {
+            RegionFile *oldest = NULL;
+            enumerate(regions, RegionFile *, region,
+            {
+                if(region->file && !region->users && region != keep && (!oldest || region->lastUsed < oldest->lastUsed)) oldest = region;
+            });
+            if(!oldest) break;
+            regions.remove(oldest->coord);
+            delete oldest;
+            openRegions--;
+        }
+    }
+
+    RegionFile *RegionStore::getRegion(const ChunkCoord &coord, bool create)
+    {
+        ChunkCoord regionCoord = RegionFile::getRegionCoord(coord);
+        SDL_LockMutex(mutex);
+        RegionFile *region = regions.find(regionCoord, NULL);
+        if(!region) region = regions[regionCoord] = new RegionFile(regionCoord);
+        region->lastUsed = ++useCounter;
+        if(!region->file && (create || !region->missing))
+        {
+            if(openRegion(region, create))
+            {
+                openRegions++;
+                evictRegions(region);
+            }
+            region->missing = !region->file;
+        }
+        bool open = region->file != NULL;
+        SDL_UnlockMutex(mutex);
+        return open ? region : NULL;
+    }
+
+    // Pins the chunk's region if it holds the chunk, or will once a queued save
+    // lands; every true result must be followed by loadChunk or cancelLoad.
+    bool RegionStore::hasChunk(const ChunkCoord &coord)
+    {
+        RegionFile *region = getRegion(coord, false);
+        if(!region) return false;
+        SDL_LockMutex(mutex);
+        bool stored = region->lengths[RegionFile::getSlot(coord)] || savesInFlight.access(coord);
+        if(stored) region->users++;
+        SDL_UnlockMutex(mutex);
+        return stored;
+    }
+
+    bool RegionStore::loadChunk(Chunk *chunk)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        vector<uchar> packed;
+        SDL_LockMutex(mutex);
+        while(savesInFlight.access(coord)) SDL_CondWait(doneCond, mutex);
+        RegionFile *region = regions.find(RegionFile::getRegionCoord(coord), NULL);
+        if(region)
+        {
+            int slot = RegionFile::getSlot(coord);
+            uint len = region->lengths[slot];
+            if(region->file && len > sizeof(uint) && region->file->seek(region->offsets[slot]) && region->file->read(packed.pad(len), len) != len)
+                packed.setsize(0);
+            region->users--;
+        }
+        SDL_UnlockMutex(mutex);
+        if(packed.empty()) return false;
+
+        uLongf rawLen = lilswap(*(const uint *)packed.getbuf());
+        if(rawLen > MAXCHUNKPAYLOAD) return false;
+        uchar *raw = new uchar[rawLen];
+        bool loaded = uncompress(raw, &rawLen, packed.getbuf() + sizeof(uint), packed.length() - sizeof(uint)) == Z_OK && chunk->load(raw, rawLen);
+        delete[] raw;
+        if(!loaded) return false;
+
+        SDL_LockMutex(mutex);
+        stats.loaded++;
+        stats.bytesRead += packed.length();
+        SDL_UnlockMutex(mutex);
+        return true;
+    }
+
+    void RegionStore::cancelLoad(const ChunkCoord &coord)
+    {
+        SDL_LockMutex(mutex);
+        RegionFile *region = regions.find(RegionFile::getRegionCoord(coord), NULL);
+        if(region) region->users--;
+        SDL_UnlockMutex(mutex);
+    }
+
+    // Takes ownership of the chunk; the saver thread returns it to the pool once
+    // written.
+    void RegionStore::saveChunk(Chunk *chunk)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        RegionFile *region = getRegion(coord, true);
+        if(!region)
+        {
+            pool->release(chunk);
+            return;
+        }
+        SDL_LockMutex(mutex);
+        region->users++;
+        int *inFlight = savesInFlight.access(coord);
+        if(inFlight) (*inFlight)++;
+        else savesInFlight[coord] = 1;
+        saveQueue.add(chunk);
+        SDL_CondSignal(queueCond);
+        SDL_UnlockMutex(mutex);
+    }
+
+    // Called with the mutex held. The payload overwrites the chunk's old one in
+    // place when it still fits its sectors, otherwise it goes to the end.
+    void RegionStore::writeChunk(Chunk *chunk, const vector<uchar> &data)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        RegionFile *region = regions.find(RegionFile::getRegionCoord(coord), NULL);
+        if(region && region->file && data.length())
+        {
+            int slot = RegionFile::getSlot(coord);
+            uint len = data.length(), offset = region->offsets[slot];
+            if(!region->lengths[slot] || sectorAlign(len) > sectorAlign(region->lengths[slot]))
+            {
+                offset = region->end;
+                region->end += sectorAlign(len);
+            }
+            stream *f = region->file;
+            if(f->seek(offset) && f->write(data.getbuf(), len) == len &&
+               f->seek(8 + slot * 2 * sizeof(uint)) && f->putlil<uint>(offset) && f->putlil<uint>(len))
+            {
+                region->offsets[slot] = offset;
+                region->lengths[slot] = len;
+                stats.saved++;
+                stats.bytesWritten += len;
+            }
+        }
+        if(region) region->users--;
+        int *inFlight = savesInFlight.access(coord);
+        if(inFlight && --*inFlight <= 0) savesInFlight.remove(coord);
+        SDL_CondBroadcast(doneCond);
+    }
+
+    int RegionStore::runSaver(void *data)
+    {
+        RegionStore *store = (RegionStore *)data;
+        vector<uchar> raw, packed;
+        SDL_LockMutex(store->mutex);
+        for(;;)
+        {
+            if(store->saveQueue.empty())
+            {
+                if(store->stopping) break;
+                SDL_CondWait(store->queueCond, store->mutex);
+                continue;
+            }
+            Chunk *chunk = store->saveQueue.remove(0);
+            SDL_UnlockMutex(store->mutex);
+
+            raw.setsize(0);
+            chunk->save(raw);
+            uLongf packedLen = compressBound(raw.length());
+            packed.setsize(0);
+            packed.pad(sizeof(uint) + packedLen);
+            *(uint *)packed.getbuf() = lilswap(uint(raw.length()));
+            if(compress2(packed.getbuf() + sizeof(uint), &packedLen, raw.getbuf(), raw.length(), Z_BEST_SPEED) == Z_OK)
+                packed.setsize(sizeof(uint) + packedLen);
+            else packed.setsize(0);
+
+            SDL_LockMutex(store->mutex);
+            store->writeChunk(chunk, packed);
+            SDL_UnlockMutex(store->mutex);
+            store->pool->release(chunk);
+            SDL_LockMutex(store->mutex);
+        }
+        SDL_UnlockMutex(store->mutex);
+        return 0;
+    }
+
+    // Blocks until every queued save has been written and flushed to disk.
+    void RegionStore::flush()
+    {
+        SDL_LockMutex(mutex);
+        while(saveQueue.length() || savesInFlight.numelems) SDL_CondWait(doneCond, mutex);
+        enumerate(regions, RegionFile *, region, { if(region->file) region->file->flush(); });
+        SDL_UnlockMutex(mutex);
+    }
+
+    void RegionStore::getStats(RegionStats &out)
+    {
+        SDL_LockMutex(mutex);
+        out = stats;
+        out.regions = openRegions;
+        out.queued = saveQueue.length();
+        SDL_UnlockMutex(mutex);
+    }
+}
@@ -0,0 +1,89 @@
+#ifndef __REGIONFILE_H__
+#define __REGIONFILE_H__
+
+#include "chunk.h"
+
+namespace game
+{
+    static const int REGION_SHIFT = 5;
+    static const int REGION_SIZE = 1 << REGION_SHIFT;
+    static const int REGION_CHUNKS = REGION_SIZE * REGION_SIZE;
+    static const int REGION_SECTOR = 4096;
+    static const int REGION_VERSION = 1;
+    static const int MAXOPENREGIONS = 16;
+
+    extern int voxelsave;
+
+    struct RegionStats
+    {
+        int regions, queued;
+        int loaded, saved;
+        llong bytesRead, bytesWritten;
+    };
+
+    // One file per 32x32 chunks: a magic/version header and an offset table,
+    // followed by zlib-compressed chunk payloads padded out to whole sectors. A
+    // payload that outgrows its sectors moves to the end of the file; the space
+    // it leaves behind is not reclaimed.
+    struct RegionFile
+    {
+        ChunkCoord coord;
+        stream *file;
+        uint offsets[REGION_CHUNKS], lengths[REGION_CHUNKS];
+        uint end;
+        int users;
+        uint lastUsed;
+        bool missing;
+
+        RegionFile(const ChunkCoord &c) : coord(c), file(NULL), end(0), users(0), lastUsed(0), missing(false)
+        {
+            memset(offsets, 0, sizeof(offsets));
+            memset(lengths, 0, sizeof(lengths));
+        }
+        ~RegionFile() { DELETEP(file); }
+
+        static ChunkCoord getRegionCoord(const ChunkCoord &c) { return ChunkCoord(c.x >> REGION_SHIFT, c.z >> REGION_SHIFT); }
+        static int getSlot(const ChunkCoord &c) { return (c.z & (REGION_SIZE - 1)) * REGION_SIZE + (c.x & (REGION_SIZE - 1)); }
+    };
+
+    // Region files are only opened and closed on the main thread (hasChunk,
+    // saveChunk); the open streams are then read by chunk workers and written by
+    // a saver thread under one mutex. A region stays pinned while a load or save
+    // for one of its chunks is outstanding.
+    class RegionStore
+    {
+    private:
+        unsigned int seed;
+        ChunkPool *pool;
+        hashtable<ChunkCoord, RegionFile *> regions;
+        int openRegions;
+        uint useCounter;
+
+        SDL_mutex *mutex;
+        SDL_cond *queueCond, *doneCond;
+        SDL_Thread *saver;
+        vector<Chunk *> saveQueue;
+        hashtable<ChunkCoord, int> savesInFlight;
+        bool stopping;
+        RegionStats stats;
+
+        RegionFile *getRegion(const ChunkCoord &coord, bool create);
+        bool openRegion(RegionFile *region, bool create);
+        void evictRegions(RegionFile *keep);
+        void writeChunk(Chunk *chunk, const vector<uchar> &data);
+        static int runSaver(void *data);
+
+    public:
+        RegionStore(unsigned int seed, ChunkPool *pool);
+        ~RegionStore();
+
+        bool hasChunk(const ChunkCoord &coord);
+        bool loadChunk(Chunk *chunk);
+        void cancelLoad(const ChunkCoord &coord);
+        void saveChunk(Chunk *chunk);
+        void flush();
+        void getStats(RegionStats &out);
+    };
+}
+
+#endif
@@ -0,0 +1,245 @@
+#include "game.h"
+#include "seedpreview.h"
+
+namespace game
+{
+    const char * const previewModeNames[PREVIEW_COUNT] = { "biome", "height", "kithgard", "skies" };
+
+    static const uchar biomeColors[BIOME_COUNT][3] =
+    {
+        { 28, 64, 148 },    // ocean
+        { 16, 40, 110 },    // deep ocean
+        { 40, 150, 170 },   // reef
+        { 56, 96, 190 },    // lake
+        { 64, 112, 210 },   // river
+        { 130, 180, 80 },   // plains
+        { 110, 150, 70 },   // hills
+        { 150, 196, 70 },   // tall grass fields
+        { 190, 180, 90 },   // savanna
+        { 228, 210, 140 },  // desert
+        { 80, 110, 70 },    // swamp
+        { 60, 120, 90 },    // mangrove forest
+        { 50, 120, 40 },    // forest
+        { 100, 150, 70 },   // birch forest
+        { 40, 100, 50 },    // long tree forest
+        { 30, 70, 30 },     // dark forest
+        { 60, 100, 80 },    // taiga
+        { 200, 210, 220 },  // tundra
+        { 130, 130, 120 },  // small mountains
+        { 150, 145, 140 },  // medium mountains
+        { 235, 235, 240 },  // tall mountains
+        { 70, 110, 80 },    // high mountain forest
+        { 190, 100, 60 }    // mesa
+    };
+
+    static const uchar kithgardColors[KITHGARD_BIOME_COUNT][3] =
+    {
+        { 90, 80, 70 },     // catacombs
+        { 140, 120, 100 },  // halls
+        { 50, 120, 90 },    // forest
+        { 70, 90, 60 },     // swamp
+        { 50, 90, 170 },    // lake
+        { 30, 50, 130 },    // ocean
+        { 170, 110, 220 },  // crystal caves
+        { 190, 80, 140 },   // mushroom forest
+        { 150, 140, 110 },  // ruins
+        { 15, 10, 25 }      // void
+    };
+
+    int getPreviewMode(const char *name)
+    {
+        if(!name || !name[0]) return PREVIEW_BIOME;
+        loopi(PREVIEW_COUNT) if(!strcmp(name, previewModeNames[i])) return i;
+        if(isdigit(name[0])) return clamp(atoi(name), 0, PREVIEW_COUNT - 1);
+        return -1;
+    }
+
+    static inline void setPixel(uchar *dst, const uchar *color, float shade = 1)
+    {
+        loopi(3) dst[i] = uchar(clamp(color[i] * shade, 0.0f, 255.0f));
+    }
+
+    static void shadeHeight(uchar *dst, double height)
+    {
+        static const uchar shallow[3] = { 70, 130, 210 }, deep[3] = { 10, 30, 90 };
+        static const uchar low[3] = { 80, 150, 70 }, mid[3] = { 170, 150, 100 }, high[3] = { 130, 125, 120 }, peak[3] = { 250, 250, 250 };
+        double above = height - WORLD_SEA_LEVEL;
+        const uchar *from, *to;
+        float t;
+        if(above < 0) { from = shallow; to = deep; t = min(float(-above / 100), 1.0f); }
+        else if(above < 80) { from = low; to = mid; t = float(above / 80); }
+        else if(above < 180) { from = mid; to = high; t = float((above - 80) / 100); }
+        else { from = high; to = peak; t = min(float((above - 180) / 100), 1.0f); }
+        loopi(3) dst[i] = uchar(from[i] + (to[i] - from[i]) * t);
+    }
+
+    struct SeedPreviewJob
+    {
+        WorldGenerator *worldGen;
+        SeedPreview *preview;
+        int originX, originZ, scale, mode;
+        int tilesX, tilesZ;
+        SDL_mutex *mutex;
+        int next;
+    };
+
+    // Each tile is one sampleColumns call of CHUNK_SIZE x CHUNK_SIZE pixels. At
+    // scale 1 the climate always comes from the lattice; it is smooth enough
+    // that biome borders move by about a block against chunks sampling every
+    // column.
+    static void renderTile(SeedPreviewJob &job, int tile, ChunkColumns &columns)
+    {
+        int tileX = tile % job.tilesX, tileZ = tile / job.tilesX;
+        int pixelX = tileX * CHUNK_SIZE, pixelZ = tileZ * CHUNK_SIZE;
+        job.worldGen->sampleColumns(job.originX + pixelX * job.scale, job.originZ + pixelZ * job.scale, job.scale, true, columns);
+
+        SeedPreview &preview = *job.preview;
+        for(int z = 0; z < CHUNK_SIZE && pixelZ + z < preview.height; ++z)
+        {
+            uchar *dst = &preview.pixels[((pixelZ + z) * preview.width + pixelX) * 3];
+            for(int x = 0; x < CHUNK_SIZE && pixelX + x < preview.width; ++x, dst += 3)
+            {
+                const ColumnClimate &column = columns.get(x, z);
+                switch(job.mode)
+                {
+                    case PREVIEW_BIOME:
+                    {
+                        // Light from -x -z; the slope is taken within the tile,
+                        // one-sided along its edges.
+                        int x1 = max(x - 1, 0), x2 = min(x + 1, CHUNK_SIZE - 1), z1 = max(z - 1, 0), z2 = min(z + 1, CHUNK_SIZE - 1);
+                        double dx = (columns.get(x2, z).terrainHeight - columns.get(x1, z).terrainHeight) / ((x2 - x1) * job.scale);
+                        double dz = (columns.get(x, z2).terrainHeight - columns.get(x, z1).terrainHeight) / ((z2 - z1) * job.scale);
+                        float shade = clamp(1.0f + float(dx + dz) * 0.25f, 0.6f, 1.4f);
+                        setPixel(dst, biomeColors[column.biome], shade);
+                        break;
+                    }
+                    case PREVIEW_HEIGHT:
+                        shadeHeight(dst, column.terrainHeight);
+                        break;
+                    case PREVIEW_KITHGARD:
+                    {
+                        KithgardBiomeType biome = WorldLayerManager::selectKithgardBiome(column.humidity, column.weirdness, (WORLD_KITHGARD_MIN + WORLD_KITHGARD_MAX) / 2);
+                        setPixel(dst, kithgardColors[biome]);
+                        break;
+                    }
+                    case PREVIEW_SKIES:
+                    {
+                        // The 2D part of the island density: the higher it is,
+                        // the lower and more massive the islands.
+                        static const uchar sky[3] = { 90, 140, 210 }, island[3] = { 245, 245, 235 };
+                        float offset = float(column.skyPeaks * 0.35 - column.skyErosion * 0.2 + column.skyContinentalness * 0.5);
+                        float t = clamp(offset * 0.5f + 0.5f, 0.0f, 1.0f);
+                        loopi(3) dst[i] = uchar(sky[i] + (island[i] - sky[i]) * t);
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    static int runPreviewWorker(void *data)
+    {
+        SeedPreviewJob *job = (SeedPreviewJob *)data;
+        ChunkColumns *columns = new ChunkColumns;
+        for(;;)
+        {
+            SDL_LockMutex(job->mutex);
+            int tile = job->next++;
+            SDL_UnlockMutex(job->mutex);
+            if(tile >= job->tilesX * job->tilesZ) break;
+            renderTile(*job, tile, *columns);
+        }
+        delete columns;
+        return 0;
+    }
+
+    // Only the 2D climate and terrain height are evaluated, in tiles spread
+    // over the worker threads, so a map covers thousands of chunks in the time
+    // a few of them take to generate.
+    void renderSeedPreview(unsigned int seed, int centerX, int centerZ, int size, int scale, int mode, int threads, SeedPreview &preview)
+    {
+        scale = clamp(scale, 1, 256);
+        size = clamp(size, scale, 16384 * scale);
+        if(threads <= 0) threads = SDL_GetCPUCount();
+        threads = clamp(threads, 1, 64);
+
+        delete[] preview.pixels;
+        preview.width = preview.height = (size + scale - 1) / scale;
+        preview.pixels = new uchar[preview.width * preview.height * 3];
+
+        WorldGenerator *worldGen = new WorldGenerator(seed);
+        SeedPreviewJob job;
+        job.worldGen = worldGen;
+        job.preview = &preview;
+        job.originX = centerX - size / 2;
+        job.originZ = centerZ - size / 2;
+        job.scale = scale;
+        job.mode = clamp(mode, 0, PREVIEW_COUNT - 1);
+        job.tilesX = job.tilesZ = (preview.width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        job.mutex = SDL_CreateMutex();
+        job.next = 0;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        vector<SDL_Thread *> workers;
+        loopi(threads - 1) workers.add(SDL_CreateThread(runPreviewWorker, "seed preview", &job));
+        runPreviewWorker(&job);
+        loopv(workers) SDL_WaitThread(workers[i], NULL);
+        preview.seconds = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+
+        SDL_DestroyMutex(job.mutex);
+        delete worldGen;
+    }
+
+    bool saveSeedPreview(const char *filename, const SeedPreview &preview)
+    {
+        stream *f = openfile(filename, "wb");
+        if(!f) return false;
+        bool written = writepng(f, preview.pixels, preview.width, preview.height, 3, preview.width * 3, false, Z_BEST_SPEED);
+        delete f;
+        return written;
+    }
+
+    static bool writeSeedPreview(const char *filename, unsigned int seed, int centerX, int centerZ, int size, int scale, int mode, int threads)
+    {
+        SeedPreview preview;
+        renderSeedPreview(seed, centerX, centerZ, size, scale, mode, threads, preview);
+        if(!saveSeedPreview(filename, preview))
+        {
+            conoutf(CON_ERROR, "could not write seed preview to %s", filename);
+            return false;
+        }
+        conoutf("seedpreview: seed %u, %s map of %dx%d blocks around %d %d at %d blocks per pixel in %.2fs, wrote %s",
+            seed, previewModeNames[clamp(mode, 0, PREVIEW_COUNT - 1)], size, size, centerX, centerZ, max(scale, 1), preview.seconds, filename);
+        return true;
+    }
+
+#ifndef WORLDGEN_HEADLESS
+    static void cmdSeedPreview(const char *filename, const char *modeName, int *seed, int *size, int *scale, int *x, int *z)
+    {
+        int mode = getPreviewMode(modeName);
+        if(!filename[0] || mode < 0)
+        {
+            conoutf(CON_ERROR, "usage: seedpreview file.png [biome|height|kithgard|skies] [seed] [size] [scale] [x] [z]");
+            return;
+        }
+        writeSeedPreview(filename, *seed ? (unsigned int)*seed : 12345, *x, *z, *size > 0 ? *size : 4096, *scale, mode, 0);
+    }
+    ICOMMAND(seedpreview, "ssiiiii", (char *filename, char *mode, int *seed, int *size, int *scale, int *x, int *z), cmdSeedPreview(filename, mode, seed, size, scale, x, z));
+#endif
+}
+
+#ifdef WORLDGEN_HEADLESS
+int main(int argc, char **argv)
+{
+    int mode = argc > 2 ? game::getPreviewMode(argv[2]) : game::PREVIEW_BIOME;
+    if(argc < 2 || argc > 9 || mode < 0)
+    {
+        printf("usage: %s file.png [biome|height|kithgard|skies] [seed] [size] [scale] [x] [z] [threads]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    unsigned int seed = argc > 3 ? (unsigned int)strtoul(argv[3], NULL, 0) : 12345;
+    int size = argc > 4 ? atoi(argv[4]) : 4096, scale = argc > 5 ? atoi(argv[5]) : 1;
+    int x = argc > 6 ? atoi(argv[6]) : 0, z = argc > 7 ? atoi(argv[7]) : 0, threads = argc > 8 ? atoi(argv[8]) : 0;
+    return game::writeSeedPreview(argv[1], seed, x, z, size, scale, mode, threads) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+#endif
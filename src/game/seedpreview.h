@@ -0,0 +1,36 @@
+#ifndef __SEEDPREVIEW_H__
+#define __SEEDPREVIEW_H__
+
+#include "worldgen.h"
+
+namespace game
+{
+    enum
+    {
+        PREVIEW_BIOME = 0,
+        PREVIEW_HEIGHT,
+        PREVIEW_KITHGARD,
+        PREVIEW_SKIES,
+        PREVIEW_COUNT
+    };
+
+    extern const char * const previewModeNames[PREVIEW_COUNT];
+
+    // A top-down map of size x size blocks centred on (centerX, centerZ), one
+    // pixel per scale blocks, as 8-bit RGB rows running along +x with +z down.
+    struct SeedPreview
+    {
+        int width, height;
+        uchar *pixels;
+        double seconds;
+
+        SeedPreview() : width(0), height(0), pixels(NULL), seconds(0) {}
+        ~SeedPreview() { delete[] pixels; }
+    };
+
+    int getPreviewMode(const char *name);
+    void renderSeedPreview(unsigned int seed, int centerX, int centerZ, int size, int scale, int mode, int threads, SeedPreview &preview);
+    bool saveSeedPreview(const char *filename, const SeedPreview &preview);
+}
+
+#endif
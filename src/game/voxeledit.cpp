@@ -0,0 +1,160 @@
+#include "game.h"
+#include "voxelworld.h"
+
+namespace game
+{
+    // Bulk edits write every block of their region straight into section
+    // storage, then fix up each touched chunk's heightmap and dirty flags once
+    // for the box of blocks that changed in it, and relight all the changes as
+    // one batch. The flagged sections are remeshed by update() like any other
+    // edit, so each is rebuilt once however many of its blocks changed.
+
+    static inline bool getEditBlock(const RegionEdit &edit, int x, int y, int z, const Block &current, Block &block)
+    {
+        switch(edit.mode)
+        {
+            case REGIONEDIT_REPLACE:
+                if(current.type != edit.match.type) return false;
+                break;
+
+            case REGIONEDIT_SPHERE:
+            {
+                int dx = x - edit.centerX, dy = y - edit.centerY, dz = z - edit.centerZ, diameter = 2 * edit.radius + 1;
+                if(4 * (dx * dx + dy * dy + dz * dz) > diameter * diameter) return false;
+                break;
+            }
+
+            case REGIONEDIT_PASTE:
+                block = edit.source->get(x - edit.minX, y - edit.minY, z - edit.minZ);
+                return !edit.skipAir || block.type != BLOCK_AIR;
+        }
+        block = edit.block;
+        return true;
+    }
+
+    // Sections the edit provably leaves alone: a fill of the block they are
+    // already made of, or a replace of a type missing from their palette.
+    static bool skipEditSection(const RegionEdit &edit, const ChunkSection *section)
+    {
+        switch(edit.mode)
+        {
+            case REGIONEDIT_FILL:
+                return section->isUniform() && section->getBlock(0) == edit.block;
+
+            case REGIONEDIT_REPLACE:
+            {
+                const vector<Block> &palette = section->getPalette();
+                loopv(palette) if(palette[i].type == edit.match.type) return false;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int VoxelWorld::editRegion(const RegionEdit &edit)
+    {
+        int minY = max(edit.minY, 0), maxY = min(edit.maxY, CHUNK_HEIGHT - 1);
+        if(edit.minX > edit.maxX || edit.minZ > edit.maxZ || minY > maxY) return 0;
+
+        // Integrating a chunk stitches its light in, so every chunk has to be
+        // resident before the first block of the batch is written.
+        ChunkCoord first = worldToChunkCoord(edit.minX, edit.minZ), last = worldToChunkCoord(edit.maxX, edit.maxZ);
+        vector<Chunk *> targets;
+        for(int cz = first.z; cz <= last.z; ++cz) for(int cx = first.x; cx <= last.x; ++cx)
+        {
+            Chunk *chunk = getOrCreateChunk(cx, cz);
+            if(chunk) targets.add(chunk);
+        }
+
+        vector<LightNode> changed;
+        loopv(targets)
+        {
+            Chunk *chunk = targets[i];
+            ChunkCoord coord = chunk->getCoord();
+            int baseX = coord.x * CHUNK_SIZE, baseZ = coord.z * CHUNK_SIZE;
+            int minX = max(edit.minX - baseX, 0), maxX = min(edit.maxX - baseX, CHUNK_SIZE - 1);
+            int minZ = max(edit.minZ - baseZ, 0), maxZ = min(edit.maxZ - baseZ, CHUNK_SIZE - 1);
+            bool wholeColumns = edit.mode == REGIONEDIT_FILL && minX == 0 && minZ == 0 && maxX == CHUNK_SIZE - 1 && maxZ == CHUNK_SIZE - 1;
+            ivec dirtyMin(CHUNK_SIZE, CHUNK_HEIGHT, CHUNK_SIZE), dirtyMax(-1, -1, -1);
+            for(int sy = minY >> 4; sy <= maxY >> 4; ++sy)
+            {
+                if(skipEditSection(edit, chunk->getSection(sy))) continue;
+                int sectionMinY = max(minY, sy * CHUNK_SIZE), sectionMaxY = min(maxY, sy * CHUNK_SIZE + CHUNK_SIZE - 1);
+                // A fill covering the whole section only reads it to find what
+                // changes and then swaps in a uniform section.
+                bool whole = wholeColumns && sectionMaxY - sectionMinY == CHUNK_SIZE - 1;
+                int before = changed.length();
+                for(int y = sectionMinY; y <= sectionMaxY; ++y) for(int z = minZ; z <= maxZ; ++z) for(int x = minX; x <= maxX; ++x)
+                {
+                    Block current = chunk->getBlock(x, y, z), block;
+                    if(!getEditBlock(edit, baseX + x, y, baseZ + z, current, block) || block == current) continue;
+                    if(!whole) chunk->writeBlock(x, y, z, block);
+                    changed.add(LightNode(baseX + x, y, baseZ + z));
+                    dirtyMin.min(ivec(x, y, z));
+                    dirtyMax.max(ivec(x, y, z));
+                }
+                if(whole && changed.length() > before) chunk->fillSection(sy, edit.block);
+            }
+            if(dirtyMax.y < 0) continue;
+            chunk->computeHeights(dirtyMin.x, dirtyMin.z, dirtyMax.x, dirtyMax.z);
+            markBoxDirty(chunk, dirtyMin.x, dirtyMin.y, dirtyMin.z, dirtyMax.x, dirtyMax.y, dirtyMax.z);
+        }
+
+        relightBlocks(changed.getbuf(), changed.length());
+        return changed.length();
+    }
+
+    int VoxelWorld::fillBox(int x1, int y1, int z1, int x2, int y2, int z2, const Block &block)
+    {
+        RegionEdit edit(REGIONEDIT_FILL);
+        edit.setBox(x1, y1, z1, x2, y2, z2);
+        edit.block = block;
+        return editRegion(edit);
+    }
+
+    int VoxelWorld::replaceBox(int x1, int y1, int z1, int x2, int y2, int z2, BlockType from, const Block &to)
+    {
+        RegionEdit edit(REGIONEDIT_REPLACE);
+        edit.setBox(x1, y1, z1, x2, y2, z2);
+        edit.match = Block(from);
+        edit.block = to;
+        return editRegion(edit);
+    }
+
+    int VoxelWorld::fillSphere(int centerX, int centerY, int centerZ, int radius, const Block &block)
+    {
+        RegionEdit edit(REGIONEDIT_SPHERE);
+        radius = max(radius, 0);
+        edit.setBox(centerX - radius, centerY - radius, centerZ - radius, centerX + radius, centerY + radius, centerZ + radius);
+        edit.centerX = centerX;
+        edit.centerY = centerY;
+        edit.centerZ = centerZ;
+        edit.radius = radius;
+        edit.block = block;
+        return editRegion(edit);
+    }
+
+    // Only reads resident chunks; blocks of chunks that aren't loaded copy as
+    // air. Returns how many blocks that was.
+    int VoxelWorld::copyBox(int x1, int y1, int z1, int x2, int y2, int z2, BlockTemplate &dst)
+    {
+        int minX = min(x1, x2), minY = min(y1, y2), minZ = min(z1, z2);
+        dst.sizeX = abs(x2 - x1) + 1;
+        dst.sizeY = abs(y2 - y1) + 1;
+        dst.sizeZ = abs(z2 - z1) + 1;
+        dst.blocks.setsize(0);
+        Block *out = dst.blocks.pad(dst.sizeX * dst.sizeY * dst.sizeZ);
+        BlockAccessor access(this);
+        return access.readBox(minX, minY, minZ, dst.sizeX, dst.sizeY, dst.sizeZ, out);
+    }
+
+    int VoxelWorld::pasteTemplate(int worldX, int worldY, int worldZ, const BlockTemplate &src, bool skipAir)
+    {
+        if(src.empty()) return 0;
+        RegionEdit edit(REGIONEDIT_PASTE);
+        edit.setBox(worldX, worldY, worldZ, worldX + src.sizeX - 1, worldY + src.sizeY - 1, worldZ + src.sizeZ - 1);
+        edit.source = &src;
+        edit.skipAir = skipAir;
+        return editRegion(edit);
+    }
+}
@@ -0,0 +1,182 @@
+#include "game.h"
+#include "voxelworld.h"
+
+namespace game
+{
+    // Light across chunks is only ever changed on the main thread, through the
+    // two queues: darkQueue holds cells whose light was just taken away, along
+    // with the level they had, and lightQueue holds cells whose current light
+    // still has to be spread to their neighbours. Cells in chunks that aren't
+    // loaded are left alone; stitchLight catches up once they are.
+
+    static inline Chunk *getLightCell(BlockAccessor &access, int x, int z, int &localX, int &localZ)
+    {
+        localX = x & (CHUNK_SIZE - 1);
+        localZ = z & (CHUNK_SIZE - 1);
+        return access.getChunk(VoxelWorld::worldToChunkCoord(x, z));
+    }
+
+    void VoxelWorld::spreadLight(int channel, BlockAccessor &access)
+    {
+        for(int i = 0; i < lightQueue.length(); ++i)
+        {
+            LightNode node = lightQueue[i];
+            int localX, localZ;
+            Chunk *chunk = getLightCell(access, node.x, node.z, localX, localZ);
+            if(!chunk) continue;
+            int level = getLightChannel(chunk->getLight(localX, node.y, localZ), channel);
+            if(level <= 1) continue;
+            loopj(6)
+            {
+                int x = node.x + lightSteps[j][0], y = node.y + lightSteps[j][1], z = node.z + lightSteps[j][2];
+                if(y < 0 || y >= CHUNK_HEIGHT) continue;
+                Chunk *next = getLightCell(access, x, z, localX, localZ);
+                if(!next) continue;
+                int opacity = getLightOpacity(next->getBlock(localX, y, localZ));
+                int nextLevel = channel == LIGHT_SKY && j == LIGHTSTEP_DOWN && level == MAXLIGHT && !opacity ? MAXLIGHT : level - max(opacity, 1);
+                int current = next->getLight(localX, y, localZ);
+                if(nextLevel <= getLightChannel(current, channel)) continue;
+                next->setLight(localX, y, localZ, setLightChannel(current, channel, nextLevel));
+                markBlockDirty(next, localX, y, localZ);
+                lightQueue.add(LightNode(x, y, z));
+            }
+        }
+        lightQueue.setsize(0);
+    }
+
+    // Darkens every neighbour that could only have been lit through a removed
+    // cell. Brighter neighbours have another source and are queued to spread
+    // back into the darkened region, as are emitters caught in it.
+    void VoxelWorld::unspreadLight(int channel, BlockAccessor &access)
+    {
+        for(int i = 0; i < darkQueue.length(); ++i)
+        {
+            LightNode node = darkQueue[i];
+            loopj(6)
+            {
+                int x = node.x + lightSteps[j][0], y = node.y + lightSteps[j][1], z = node.z + lightSteps[j][2];
+                if(y < 0 || y >= CHUNK_HEIGHT) continue;
+                int localX, localZ;
+                Chunk *next = getLightCell(access, x, z, localX, localZ);
+                if(!next) continue;
+                int current = next->getLight(localX, y, localZ), level = getLightChannel(current, channel);
+                if(!level) continue;
+                if(level < node.level || (channel == LIGHT_SKY && j == LIGHTSTEP_DOWN && node.level == MAXLIGHT && level == MAXLIGHT))
+                {
+                    int emission = channel == LIGHT_BLOCK ? getLightEmission(next->getBlock(localX, y, localZ)) : 0;
+                    next->setLight(localX, y, localZ, setLightChannel(current, channel, emission));
+                    markBlockDirty(next, localX, y, localZ);
+                    darkQueue.add(LightNode(x, y, z, level));
+                    if(emission) lightQueue.add(LightNode(x, y, z));
+                }
+                else lightQueue.add(LightNode(x, y, z));
+            }
+        }
+        darkQueue.setsize(0);
+    }
+
+    // Relights around a block that just changed: whatever light the cell held
+    // is withdrawn, then the cell's own emission and its neighbours' light are
+    // spread back in. Only the region the old light reached is touched.
+    void VoxelWorld::updateLight(int worldX, int worldY, int worldZ)
+    {
+        LightNode block(worldX, worldY, worldZ);
+        relightBlocks(&block, 1);
+    }
+
+    // Same as updateLight for a whole batch of changed blocks at once: the
+    // light of every block is withdrawn before anything is spread back, so
+    // each channel takes one removal and one add pass for the batch, and a
+    // neighbour is only queued if it has light to give.
+    void VoxelWorld::relightBlocks(const LightNode *blocks, int count)
+    {
+        BlockAccessor access(this);
+        loopk(LIGHT_CHANNELS)
+        {
+            loopi(count)
+            {
+                const LightNode &node = blocks[i];
+                if(node.y < 0 || node.y >= CHUNK_HEIGHT) continue;
+                int localX, localZ;
+                Chunk *chunk = getLightCell(access, node.x, node.z, localX, localZ);
+                if(!chunk) continue;
+                int current = chunk->getLight(localX, node.y, localZ), level = getLightChannel(current, k);
+                if(!level) continue;
+                chunk->setLight(localX, node.y, localZ, setLightChannel(current, k, 0));
+                markBlockDirty(chunk, localX, node.y, localZ);
+                darkQueue.add(LightNode(node.x, node.y, node.z, level));
+            }
+            unspreadLight(k, access);
+
+            loopi(count)
+            {
+                const LightNode &node = blocks[i];
+                if(node.y < 0 || node.y >= CHUNK_HEIGHT) continue;
+                int localX, localZ;
+                Chunk *chunk = getLightCell(access, node.x, node.z, localX, localZ);
+                if(!chunk) continue;
+                Block block = chunk->getBlock(localX, node.y, localZ);
+                int emission = k == LIGHT_BLOCK ? getLightEmission(block) : 0;
+                if(emission)
+                {
+                    int current = chunk->getLight(localX, node.y, localZ);
+                    chunk->setLight(localX, node.y, localZ, setLightChannel(current, k, max(emission, getLightChannel(current, k))));
+                    markBlockDirty(chunk, localX, node.y, localZ);
+                    lightQueue.add(node);
+                }
+                if(getLightOpacity(block) >= MAXLIGHT) continue;
+                loopj(6)
+                {
+                    // Above the world reads as open sky, which can spread down.
+                    int x = node.x + lightSteps[j][0], y = node.y + lightSteps[j][1], z = node.z + lightSteps[j][2];
+                    Chunk *next = getLightCell(access, x, z, localX, localZ);
+                    if(next && getLightChannel(next->getLight(localX, y, localZ), k) > 1) lightQueue.add(LightNode(x, y, z));
+                }
+            }
+            spreadLight(k, access);
+        }
+    }
+
+    // A chunk is lit on its own when it is built, so every seam it shares with
+    // a loaded neighbour is out of date on both sides: queue whichever side of
+    // each pair of cells can brighten the other and let it spread.
+    void VoxelWorld::stitchLight(Chunk *chunk)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        Chunk *neighbours[CHUNK_SIDES];
+        getNeighbours(coord, neighbours);
+        BlockAccessor access(this);
+        loopk(LIGHT_CHANNELS)
+        {
+            loopi(CHUNK_SIDES) if(neighbours[i])
+            {
+                Chunk *neighbour = neighbours[i];
+                ChunkCoord across = neighbour->getCoord();
+                bool alongZ = i == CHUNK_SIDE_XNEG || i == CHUNK_SIDE_XPOS;
+                int edge = i == CHUNK_SIDE_XNEG || i == CHUNK_SIDE_ZNEG ? 0 : CHUNK_SIZE - 1, acrossEdge = CHUNK_SIZE - 1 - edge;
+                for(int sy = 0; sy < CHUNK_SECTIONS; ++sy)
+                {
+                    if(chunk->hasUniformLight(sy) && neighbour->hasUniformLight(sy) && chunk->getUniformLight(sy) == neighbour->getUniformLight(sy)) continue;
+                    for(int y = sy * CHUNK_SIZE; y < (sy + 1) * CHUNK_SIZE; ++y) loopj(CHUNK_SIZE)
+                    {
+                        int x = alongZ ? edge : j, z = alongZ ? j : edge;
+                        int acrossX = alongZ ? acrossEdge : j, acrossZ = alongZ ? j : acrossEdge;
+                        int level = getLightChannel(chunk->getLight(x, y, z), k), acrossLevel = getLightChannel(neighbour->getLight(acrossX, y, acrossZ), k);
+                        if(level > acrossLevel + 1) lightQueue.add(LightNode(coord.x * CHUNK_SIZE + x, y, coord.z * CHUNK_SIZE + z));
+                        else if(acrossLevel > level + 1) lightQueue.add(LightNode(across.x * CHUNK_SIZE + acrossX, y, across.z * CHUNK_SIZE + acrossZ));
+                    }
+                }
+            }
+            spreadLight(k, access);
+        }
+    }
+
+    int VoxelWorld::getLight(int worldX, int worldY, int worldZ)
+    {
+        ChunkCoord coord;
+        int localX, localY, localZ;
+        worldToLocalCoord(worldX, worldY, worldZ, coord, localX, localY, localZ);
+        Chunk *chunk = getChunk(coord);
+        return chunk ? chunk->getLight(localX, localY, localZ) : 0;
+    }
+}
@@ -0,0 +1,194 @@
+#include "game.h"
+#include "voxelworld.h"
+
+namespace game
+{
+    // Ray queries walk the block grid cell by cell (Amanatides & Woo): each
+    // axis keeps the distance at which the ray next crosses a cell boundary
+    // along it, and the walk always steps along the axis that crosses first.
+    // A section that holds nothing the ray can stop at is crossed without
+    // reading any of its blocks. Rays only see resident chunks and end where
+    // they run into one that isn't loaded, which is reported apart from a
+    // miss; sight checks count such a ray as blocked, since whatever lies in
+    // the missing chunk is unknown.
+
+    // Face of the entered block the ray comes in through, by axis and whether
+    // the ray steps up along it.
+    static const int rayFaces[3][2] =
+    {
+        { FACE_RIGHT, FACE_LEFT },
+        { FACE_TOP, FACE_BOTTOM },
+        { FACE_FRONT, FACE_BACK }
+    };
+
+    static inline bool stopsRay(const Block &block, int mode)
+    {
+        switch(mode)
+        {
+            case VOXELRAY_SOLID: return isHeightBlock(block, HEIGHTMAP_SOLID);
+            case VOXELRAY_OPAQUE: return isHeightBlock(block, HEIGHTMAP_OPAQUE);
+            default: return block.type != BLOCK_AIR;
+        }
+    }
+
+    static inline bool sectionStopsRay(const ChunkSection *section, int mode)
+    {
+        if(section->isEmpty()) return false;
+        if(mode == VOXELRAY_ANY) return true;
+        const vector<Block> &palette = section->getPalette();
+        loopv(palette) if(stopsRay(palette[i], mode)) return true;
+        return false;
+    }
+
+    // dir must be normalized; distances are along it, as with raycube.
+    static bool traceRay(BlockAccessor &access, const vec &origin, const vec &dir, float maxDist, VoxelRayHit &hit, int mode)
+    {
+        hit.block = Block(BLOCK_AIR);
+        hit.x = hit.y = hit.z = 0;
+        hit.face = -1;
+        hit.dist = maxDist;
+        hit.unloaded = false;
+
+        // Start where the ray enters the world's height range.
+        float dist = 0;
+        int face = -1;
+        if(origin.y >= CHUNK_HEIGHT)
+        {
+            if(dir.y >= 0) return false;
+            dist = (CHUNK_HEIGHT - origin.y) / dir.y;
+            face = FACE_TOP;
+        }
+        else if(origin.y < 0)
+        {
+            if(dir.y <= 0) return false;
+            dist = -origin.y / dir.y;
+            face = FACE_BOTTOM;
+        }
+        if(dist > maxDist) return false;
+
+        vec pos = vec(dir).mul(dist).add(origin);
+        int cell[3] = { int(floorf(pos.x)), clamp(int(floorf(pos.y)), 0, CHUNK_HEIGHT - 1), int(floorf(pos.z)) }, step[3];
+        float next[3], delta[3];
+        loopi(3)
+        {
+            if(dir[i] > 0)
+            {
+                step[i] = 1;
+                delta[i] = 1 / dir[i];
+                next[i] = dist + (cell[i] + 1 - pos[i]) * delta[i];
+            }
+            else if(dir[i] < 0)
+            {
+                step[i] = -1;
+                delta[i] = -1 / dir[i];
+                next[i] = dist + (pos[i] - cell[i]) * delta[i];
+            }
+            else
+            {
+                step[i] = 0;
+                delta[i] = next[i] = 1e16f;
+            }
+        }
+
+        for(;;)
+        {
+            Chunk *chunk = access.getChunk(VoxelWorld::worldToChunkCoord(cell[0], cell[2]));
+            if(!chunk)
+            {
+                hit.dist = dist;
+                hit.unloaded = true;
+                return false;
+            }
+
+            int axis;
+            const ChunkSection *section = chunk->getSection(cell[1] >> 4);
+            if(sectionStopsRay(section, mode))
+            {
+                Block block = section->getBlock(ChunkSection::toIndex(cell[0] & (CHUNK_SIZE - 1), cell[1] & (CHUNK_SIZE - 1), cell[2] & (CHUNK_SIZE - 1)));
+                if(stopsRay(block, mode))
+                {
+                    hit.block = block;
+                    hit.x = cell[0];
+                    hit.y = cell[1];
+                    hit.z = cell[2];
+                    hit.face = face;
+                    hit.dist = dist;
+                    return true;
+                }
+                axis = next[0] < next[1] ? (next[0] < next[2] ? 0 : 2) : (next[1] < next[2] ? 1 : 2);
+            }
+            else
+            {
+                // Find the axis along which the ray leaves the section first,
+                // catch the other axes up to that distance and move to the
+                // last cell before the exit in one go.
+                int cells[3];
+                axis = -1;
+                float exit = 1e16f;
+                loopi(3) if(step[i])
+                {
+                    int offset = cell[i] & (CHUNK_SIZE - 1);
+                    cells[i] = step[i] > 0 ? CHUNK_SIZE - 1 - offset : offset;
+                    float crossing = next[i] + cells[i] * delta[i];
+                    if(crossing < exit) { exit = crossing; axis = i; }
+                }
+                if(axis < 0 || exit > maxDist) return false;
+                loopi(3) if(i != axis && step[i])
+                {
+                    while(next[i] < exit) { cell[i] += step[i]; next[i] += delta[i]; }
+                }
+                cell[axis] += cells[axis] * step[axis];
+                next[axis] += cells[axis] * delta[axis];
+            }
+
+            dist = next[axis];
+            if(dist > maxDist) return false;
+            cell[axis] += step[axis];
+            next[axis] += delta[axis];
+            face = rayFaces[axis][step[axis] > 0 ? 1 : 0];
+            if(cell[1] < 0 || cell[1] >= CHUNK_HEIGHT) return false;
+        }
+    }
+
+    bool VoxelWorld::raycast(const vec &origin, const vec &dir, float maxDist, VoxelRayHit &hit, int mode)
+    {
+        BlockAccessor access(this);
+        return traceRay(access, origin, dir, maxDist, hit, mode);
+    }
+
+    // One accessor serves the whole batch, so rays cast from around the same
+    // spot share their chunk lookups. Returns how many rays hit.
+    int VoxelWorld::raycast(const VoxelRay *rays, int count, VoxelRayHit *hits, int mode)
+    {
+        BlockAccessor access(this);
+        int numHits = 0;
+        loopi(count) if(traceRay(access, rays[i].origin, rays[i].dir, rays[i].maxDist, hits[i], mode)) numHits++;
+        return numHits;
+    }
+
+    static inline bool traceSight(BlockAccessor &access, const vec &from, const vec &to, int mode)
+    {
+        vec dir = vec(to).sub(from);
+        float dist = dir.magnitude();
+        if(dist <= 0) return true;
+        dir.mul(1 / dist);
+        VoxelRayHit hit;
+        return !traceRay(access, from, dir, dist, hit, mode) && !hit.unloaded;
+    }
+
+    bool VoxelWorld::lineOfSight(const vec &from, const vec &to, int mode)
+    {
+        BlockAccessor access(this);
+        return traceSight(access, from, to, mode);
+    }
+
+    // Sight checks from one eye to many targets, as an AI scanning for
+    // enemies does. Returns how many targets are visible.
+    int VoxelWorld::lineOfSight(const vec &from, const vec *targets, int count, bool *visible, int mode)
+    {
+        BlockAccessor access(this);
+        int numVisible = 0;
+        loopi(count) if((visible[i] = traceSight(access, from, targets[i], mode))) numVisible++;
+        return numVisible;
+    }
+}
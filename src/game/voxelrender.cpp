@@ -0,0 +1,106 @@
+#include "engine.h"
+#include "voxelworld.h"
+
+namespace game
+{
+    static const vec blockColors[BLOCK_COUNT] =
+    {
+        vec(0, 0, 0),           // air
+        vec(0.5f, 0.5f, 0.5f),  // stone
+        vec(0.55f, 0.4f, 0.25f),// dirt
+        vec(0.3f, 0.65f, 0.2f), // grass
+        vec(0.9f, 0.85f, 0.6f), // sand
+        vec(0.2f, 0.4f, 0.8f),  // water
+        vec(0.45f, 0.3f, 0.15f),// wood
+        vec(0.2f, 0.5f, 0.15f), // leaves
+        vec(0.95f, 0.95f, 1.0f),// snow
+        vec(0.7f, 0.85f, 1.0f), // ice
+        vec(0.55f, 0.5f, 0.5f), // gravel
+        vec(0.25f, 0.25f, 0.25f),// coal ore
+        vec(0.7f, 0.55f, 0.45f),// iron ore
+        vec(0.9f, 0.8f, 0.3f),  // gold ore
+        vec(0.4f, 0.9f, 0.9f),  // diamond ore
+        vec(0.6f, 0.6f, 0.7f),  // clay
+        vec(0.15f, 0.15f, 0.15f),// bedrock
+        vec(0.75f, 0.7f, 0.85f),// floatstone
+        vec(0.6f, 0.45f, 0.3f), // sky dirt
+        vec(0.45f, 0.8f, 0.4f), // sky grass
+        vec(0.35f, 0.7f, 0.25f),// vegetation
+        vec(0.35f, 0.3f, 0.4f), // kithgard stone
+        vec(0.4f, 0.3f, 0.35f), // kithgard soil
+        vec(0.3f, 0.2f, 0.6f),  // kithgard water
+        vec(1.0f, 0.9f, 0.5f),  // kithgard glowstone
+        vec(0.7f, 0.4f, 0.9f),  // kithgard crystal
+        vec(0.6f, 0.65f, 0.7f), // kithgard metal
+        vec(0.9f, 0.9f, 0.95f)  // kithgard cloud
+    };
+
+    static void uploadChunkMesh(ChunkMesh &mesh)
+    {
+        mesh.needsUpload = false;
+        mesh.numVertices = mesh.vertices.length();
+        mesh.numIndices = mesh.indices.length();
+        if(!mesh.numIndices) return;
+
+        if(!mesh.vbo) glGenBuffers_(1, &mesh.vbo);
+        glBindBuffer_(GL_ARRAY_BUFFER, mesh.vbo);
+        glBufferData_(GL_ARRAY_BUFFER, mesh.vertices.length()*sizeof(VoxelVertex), mesh.vertices.getbuf(), GL_STATIC_DRAW);
+
+        if(!mesh.ebo) glGenBuffers_(1, &mesh.ebo);
+        glBindBuffer_(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+        glBufferData_(GL_ELEMENT_ARRAY_BUFFER, mesh.indices.length()*sizeof(uint), mesh.indices.getbuf(), GL_STATIC_DRAW);
+    }
+
+    // Only used to rank streaming work: tests the 16^3 block of the column at
+    // camera height against the frustum of the last rendered frame.
+    bool VoxelWorld::isChunkInView(const ChunkCoord &coord)
+    {
+        ivec o(coord.x * CHUNK_SIZE, clamp(int(camera1->o.y), 0, CHUNK_HEIGHT - CHUNK_SIZE) & ~(CHUNK_SIZE - 1), coord.z * CHUNK_SIZE);
+        return isvisiblecube(o, CHUNK_SIZE) != VFC_NOT_VISIBLE;
+    }
+
+    // Buffers of released chunks are freed here, on the render side, rather
+    // than wherever the chunk happened to be released.
+    void VoxelWorld::flushDeadBuffers()
+    {
+        if(deadBuffers.empty()) return;
+        glDeleteBuffers_(deadBuffers.length(), deadBuffers.getbuf());
+        deadBuffers.setsize(0);
+    }
+
+    void VoxelWorld::render()
+    {
+        flushDeadBuffers();
+
+        SETSHADER(voxelworld);
+        LOCALPARAMV(voxelcolors, blockColors, BLOCK_COUNT);
+
+        // Uploads past the budget wait for a later frame; the chunk keeps drawing
+        // its previous buffers, if it has any, until then.
+        Uint32 uploadStart = SDL_GetTicks();
+        bool canUpload = true;
+        gle::enablevertex();
+        enumeratekt(chunks, ChunkCoord, coord, Chunk*, chunk,
+        {
+            ChunkMesh &mesh = chunk->getMesh();
+            if(mesh.needsUpload && canUpload)
+            {
+                uploadChunkMesh(mesh);
+                canUpload = SDL_GetTicks() - uploadStart < (Uint32)chunkuploadtime;
+            }
+            if(!mesh.numIndices) continue;
+
+            LOCALPARAMF(voxelorigin, coord.x * CHUNK_SIZE, 0, coord.z * CHUNK_SIZE);
+
+            glBindBuffer_(GL_ARRAY_BUFFER, mesh.vbo);
+            glBindBuffer_(GL_ELEMENT_ARRAY_BUFFER, mesh.ebo);
+            gle::vertexpointer(sizeof(VoxelVertex), (const ushort *)0, GL_UNSIGNED_SHORT, 4);
+            glDrawRangeElements_(GL_TRIANGLES, 0, mesh.numVertices - 1, mesh.numIndices, GL_UNSIGNED_INT, 0);
+            xtravertsva += mesh.numVertices;
+        });
+        gle::disablevertex();
+
+        glBindBuffer_(GL_ARRAY_BUFFER, 0);
+        glBindBuffer_(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+}
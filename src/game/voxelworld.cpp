@@ -6,50 +6,214 @@
 
 namespace game
 {
+    VARP(chunkdistance, 2, 6, 32);
+    VARP(chunkthreads, 0, 0, 16);
+    VARP(chunkintegratetime, 1, 4, 100);
+    VARP(chunkremeshtime, 1, 2, 100);
+    VARP(chunkuploadtime, 1, 2, 100);
+    VARP(chunkunloadmargin, 0, 2, 8);
+    VARP(chunklod, 0, 1, 1);
+    VARP(chunklod1, 1, 4, 64);
+    VARP(chunklod2, 1, 8, 64);
+    VARP(chunklod3, 1, 16, 64);
+
+    static inline int chunkDistanceSquared(const ChunkCoord &a, const ChunkCoord &b)
+    {
+        int dx = a.x - b.x, dz = a.z - b.z;
+        return dx*dx + dz*dz;
+    }
+
+    static inline bool isChunkInRange(const ChunkCoord &coord, const ChunkCoord &center, int radius)
+    {
+        return chunkDistanceSquared(coord, center) <= radius*radius;
+    }
+
+    // Chunks at least chunklod1, chunklod2 and chunklod3 chunks away are meshed
+    // at 2x, 4x and 8x coarser cells. Smooth terrain is always meshed in full.
+    static int getLodLevel(float distance)
+    {
+        if(!chunklod || smoothterrain) return 0;
+        int level = 0;
+        if(distance >= chunklod1) level++;
+        if(distance >= chunklod2) level++;
+        if(distance >= chunklod3) level++;
+        return level;
+    }
+
     VoxelWorld::VoxelWorld(unsigned int seed, int renderDist) :
         worldGen(new WorldGenerator(seed)),
+        chunkPool(new ChunkPool(0)),
+        regions(new RegionStore(seed, chunkPool)),
         renderDistance(renderDist),
-        lastPlayerChunk(0, 0)
+        lastPlayerChunk(0, 0),
+        playerChunkKnown(false),
+        jobMutex(SDL_CreateMutex()),
+        jobCond(SDL_CreateCond()),
+        doneCond(SDL_CreateCond()),
+        activeJobs(0),
+        stopping(false)
     {
         BiomeManager::init();
+        int residentRadius = renderDistance + chunkunloadmargin;
+        chunkPool->setCapacity((2*residentRadius + 1) * (2*residentRadius + 1));
+
+        gridShift = 0;
+        while((1 << gridShift) < 2*residentRadius + 1) gridShift++;
+        gridMask = (1 << gridShift) - 1;
+        grid = new ChunkSlot[1 << (2*gridShift)];
+        loopi(1 << (2*gridShift)) grid[i].chunk = NULL;
+        overflowChunks = 0;
+        startWorkers();
     }
 
     VoxelWorld::~VoxelWorld()
     {
+        stopWorkers();
         clear();
+        flushDeadBuffers();
+        SDL_DestroyCond(doneCond);
+        SDL_DestroyCond(jobCond);
+        SDL_DestroyMutex(jobMutex);
+        delete regions;
+        delete chunkPool;
         delete worldGen;
+        delete[] grid;
+    }
+
+    void VoxelWorld::startWorkers()
+    {
+        int numthreads = chunkthreads > 0 ? chunkthreads : clamp(SDL_GetCPUCount() - 1, 1, 16);
+        loopi(numthreads) workers.add(SDL_CreateThread(runWorker, "chunk worker", this));
+    }
+
+    void VoxelWorld::stopWorkers()
+    {
+        SDL_LockMutex(jobMutex);
+        stopping = true;
+        SDL_CondBroadcast(jobCond);
+        SDL_UnlockMutex(jobMutex);
+        loopv(workers) SDL_WaitThread(workers[i], NULL);
+        workers.setsize(0);
+    }
+
+    int VoxelWorld::runWorker(void *data)
+    {
+        VoxelWorld *world = (VoxelWorld *)data;
+        SDL_LockMutex(world->jobMutex);
+        while(!world->stopping)
+        {
+            if(world->queuedJobs.empty())
+            {
+                SDL_CondWait(world->jobCond, world->jobMutex);
+                continue;
+            }
+            ChunkJob job = world->queuedJobs.pop();
+            Chunk *chunk = job.chunk;
+            world->activeJobs++;
+            SDL_UnlockMutex(world->jobMutex);
+
+            world->buildChunk(chunk, job.stored);
+
+            SDL_LockMutex(world->jobMutex);
+            world->activeJobs--;
+            world->finishedChunks.add(chunk);
+            SDL_CondBroadcast(world->doneCond);
+        }
+        SDL_UnlockMutex(world->jobMutex);
+        return 0;
     }
 
     void VoxelWorld::clear()
     {
-        enumerate(chunks, Chunk*, chunk,
+        SDL_LockMutex(jobMutex);
+        loopv(queuedJobs)
         {
-            delete chunk;
-        });
+            if(queuedJobs[i].stored) regions->cancelLoad(queuedJobs[i].chunk->getCoord());
+            chunkPool->release(queuedJobs[i].chunk);
+        }
+        queuedJobs.setsize(0);
+        while(activeJobs > 0) SDL_CondWait(doneCond, jobMutex);
+        loopv(finishedChunks) chunkPool->release(finishedChunks[i]);
+        finishedChunks.setsize(0);
+        SDL_UnlockMutex(jobMutex);
+        pendingChunks.clear();
+
+        enumerate(chunks, Chunk*, chunk, releaseChunk(chunk));
         chunks.clear();
+        loopi(1 << (2*gridShift)) grid[i].chunk = NULL;
+        overflowChunks = 0;
     }
 
-    Chunk* VoxelWorld::getChunk(const ChunkCoord &coord)
+    // Generated or edited chunks go to the region store, which writes them out in
+    // the background and then hands them back to the pool.
+    void VoxelWorld::releaseChunk(Chunk *chunk)
     {
-        Chunk **c = chunks.access(coord);
-        return c ? *c : NULL;
+        ChunkMesh &mesh = chunk->getMesh();
+        if(mesh.vbo) deadBuffers.add(mesh.vbo);
+        if(mesh.ebo) deadBuffers.add(mesh.ebo);
+        mesh.vbo = mesh.ebo = 0;
+        mesh.numVertices = mesh.numIndices = 0;
+        if(voxelsave && chunk->isGenerated() && chunk->needsSave()) regions->saveChunk(chunk);
+        else chunkPool->release(chunk);
     }
 
-    Chunk* VoxelWorld::getChunk(int x, int z)
+    // Safe to call from worker threads.
+    void VoxelWorld::buildChunk(Chunk *chunk, bool stored)
     {
-        return getChunk(ChunkCoord(x, z));
+        if(stored && regions->loadChunk(chunk)) chunk->computeLight();
+        else worldGen->generateChunk(chunk);
+        worldGen->generateChunkMesh(chunk);
     }
 
-    Chunk* VoxelWorld::getOrCreateChunk(const ChunkCoord &coord)
+    // A slot holds the chunk nearest the player that maps to it; any other chunk
+    // mapping there only lives in the hashtable.
+    void VoxelWorld::addChunk(Chunk *chunk)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        chunks[coord] = chunk;
+        ChunkSlot &slot = grid[getSlotIndex(coord)];
+        if(slot.chunk)
+        {
+            overflowChunks++;
+            if(chunkDistanceSquared(slot.coord, lastPlayerChunk) <= chunkDistanceSquared(coord, lastPlayerChunk)) return;
+        }
+        slot.coord = coord;
+        slot.chunk = chunk;
+    }
+
+    void VoxelWorld::removeChunk(const ChunkCoord &coord)
     {
-        Chunk *&entry = chunks[coord];
-        if(!entry)
+        chunks.remove(coord);
+        int index = getSlotIndex(coord);
+        ChunkSlot &slot = grid[index];
+        if(!slot.chunk || !(slot.coord == coord))
         {
-            entry = new Chunk(coord);
-            worldGen->generateChunk(entry);
-            worldGen->generateChunkMesh(entry);
+            overflowChunks--;
+            return;
         }
-        return entry;
+        slot.chunk = NULL;
+        if(!overflowChunks) return;
+        enumeratekt(chunks, ChunkCoord, other, Chunk*, chunk,
+        {
+            if(!slot.chunk && getSlotIndex(other) == index)
+            {
+                slot.coord = other;
+                slot.chunk = chunk;
+                overflowChunks--;
+            }
+        });
+    }
+
+    Chunk* VoxelWorld::getOrCreateChunk(const ChunkCoord &coord)
+    {
+        Chunk *existing = getChunk(coord);
+        if(existing) return existing;
+        if(pendingChunks.access(coord)) return waitForChunk(coord);
+
+        Chunk *chunk = chunkPool->alloc(coord);
+        buildChunk(chunk, voxelsave && regions->hasChunk(coord));
+        integrateChunk(chunk);
+        return chunk;
     }
 
     Chunk* VoxelWorld::getOrCreateChunk(int x, int z)
@@ -57,6 +221,193 @@ namespace game
         return getOrCreateChunk(ChunkCoord(x, z));
     }
 
+    // Something on the main thread needs a chunk that is already queued: pull it
+    // out of the queue and generate it here, or block until its worker is done.
+    Chunk* VoxelWorld::waitForChunk(const ChunkCoord &coord)
+    {
+        Chunk *chunk = pendingChunks[coord];
+        SDL_LockMutex(jobMutex);
+        loopv(queuedJobs) if(queuedJobs[i].chunk == chunk)
+        {
+            bool stored = queuedJobs.remove(i).stored;
+            SDL_UnlockMutex(jobMutex);
+            buildChunk(chunk, stored);
+            integrateChunk(chunk);
+            return chunk;
+        }
+        while(finishedChunks.find(chunk) < 0) SDL_CondWait(doneCond, jobMutex);
+        finishedChunks.removeobj(chunk);
+        SDL_UnlockMutex(jobMutex);
+        integrateChunk(chunk);
+        return chunk;
+    }
+
+    void VoxelWorld::requestChunk(const ChunkCoord &coord)
+    {
+        if(getChunk(coord) || pendingChunks.access(coord)) return;
+        Chunk *chunk = chunkPool->alloc(coord);
+        chunk->setLod(getLodLevel(sqrtf(chunkDistanceSquared(coord, lastPlayerChunk))));
+        pendingChunks[coord] = chunk;
+        bool stored = voxelsave && regions->hasChunk(coord);
+        SDL_LockMutex(jobMutex);
+        ChunkJob &job = queuedJobs.add();
+        job.chunk = chunk;
+        job.distance = 0;
+        job.stored = stored;
+        SDL_UnlockMutex(jobMutex);
+    }
+
+    static inline bool chunkjobcmp(const ChunkJob &a, const ChunkJob &b)
+    {
+        return a.distance > b.distance;
+    }
+
+    // Workers pop from the end of the queue, so keep it sorted farthest first and
+    // drop anything that fell out of range before a worker got to it. Chunks
+    // outside the view frustum rank as if they were twice as far away, except
+    // the ones right around the player.
+    void VoxelWorld::prioritizeJobs(const ChunkCoord &playerChunk)
+    {
+        SDL_LockMutex(jobMutex);
+        if(queuedJobs.empty())
+        {
+            SDL_UnlockMutex(jobMutex);
+            return;
+        }
+        loopvrev(queuedJobs)
+        {
+            ChunkJob &job = queuedJobs[i];
+            ChunkCoord coord = job.chunk->getCoord();
+            if(!isChunkInRange(coord, playerChunk, renderDistance))
+            {
+                pendingChunks.remove(coord);
+                if(job.stored) regions->cancelLoad(coord);
+                chunkPool->release(job.chunk);
+                queuedJobs.remove(i);
+                continue;
+            }
+            job.distance = chunkDistanceSquared(coord, playerChunk);
+            if(job.distance > 2*2 && !isChunkInView(coord)) job.distance *= 4;
+        }
+        queuedJobs.sort(chunkjobcmp);
+        SDL_CondBroadcast(jobCond);
+        SDL_UnlockMutex(jobMutex);
+    }
+
+    static const int chunkNeighbourOffsets[CHUNK_NEIGHBOURS][2] =
+    {
+        { -1, 0 }, { 1, 0 }, { 0, -1 }, { 0, 1 },
+        { -1, -1 }, { 1, -1 }, { -1, 1 }, { 1, 1 }
+    };
+
+    void VoxelWorld::getNeighbours(const ChunkCoord &coord, Chunk **neighbours, int count)
+    {
+        loopi(count) neighbours[i] = getChunk(coord.x + chunkNeighbourOffsets[i][0], coord.z + chunkNeighbourOffsets[i][1]);
+    }
+
+    // Both sides of every seam the new chunk closes were meshed against air and
+    // lit as if the other side were dark; flag them so only those border faces
+    // get rebuilt, and let light cross the seams.
+    void VoxelWorld::integrateChunk(Chunk *chunk)
+    {
+        ChunkCoord coord = chunk->getCoord();
+        pendingChunks.remove(coord);
+        addChunk(chunk);
+
+        Chunk *neighbours[CHUNK_NEIGHBOURS];
+        getNeighbours(coord, neighbours, CHUNK_NEIGHBOURS);
+        // Smooth terrain cells near a side read the neighbouring chunks,
+        // diagonals included, and are rebuilt along with the whole mesh.
+        if(smoothterrain) loopi(CHUNK_NEIGHBOURS)
+        {
+            if(!neighbours[i]) continue;
+            chunk->markMeshRebuild();
+            neighbours[i]->markMeshRebuild();
+        }
+        else loopi(CHUNK_SIDES) if(neighbours[i])
+        {
+            chunk->markBorderDirty(i);
+            neighbours[i]->markBorderDirty(i ^ 1);
+        }
+        stitchLight(chunk);
+    }
+
+    void VoxelWorld::updateChunkMesh(Chunk *chunk)
+    {
+        if(!chunk->needsMeshUpdate()) return;
+        Chunk *neighbours[CHUNK_NEIGHBOURS];
+        getNeighbours(chunk->getCoord(), neighbours, CHUNK_NEIGHBOURS);
+        if(!chunk->isMeshBuilt()) worldGen->generateChunkMesh(chunk, neighbours);
+        else worldGen->generateDirtyMesh(chunk, neighbours);
+    }
+
+    struct RemeshJob
+    {
+        Chunk *chunk;
+        int distance;
+    };
+
+    static inline bool remeshjobcmp(const RemeshJob &a, const RemeshJob &b)
+    {
+        return a.distance < b.distance;
+    }
+
+    // Brings stale meshes up to date, nearest chunks first, until the budget
+    // runs out; anything left keeps drawing its old mesh until a later frame.
+    void VoxelWorld::remeshChunks(int budgetMillis)
+    {
+        vector<RemeshJob> jobs;
+        enumeratekt(chunks, ChunkCoord, coord, Chunk*, chunk,
+        {
+            if(!chunk->needsMeshUpdate()) continue;
+            RemeshJob &job = jobs.add();
+            job.chunk = chunk;
+            job.distance = chunkDistanceSquared(coord, lastPlayerChunk);
+        });
+        if(jobs.empty()) return;
+        jobs.sort(remeshjobcmp);
+
+        Uint32 start = SDL_GetTicks();
+        loopv(jobs)
+        {
+            updateChunkMesh(jobs[i].chunk);
+            if(SDL_GetTicks() - start >= (Uint32)budgetMillis) break;
+        }
+    }
+
+    void VoxelWorld::integrateFinishedChunks(int budgetMillis)
+    {
+        Uint32 start = SDL_GetTicks();
+        for(;;)
+        {
+            SDL_LockMutex(jobMutex);
+            Chunk *chunk = finishedChunks.empty() ? NULL : finishedChunks.pop();
+            SDL_UnlockMutex(jobMutex);
+            if(!chunk) break;
+
+            ChunkCoord coord = chunk->getCoord();
+            if(!isChunkInRange(coord, lastPlayerChunk, renderDistance + chunkunloadmargin))
+            {
+                pendingChunks.remove(coord);
+                releaseChunk(chunk);
+                continue;
+            }
+            integrateChunk(chunk);
+            if(SDL_GetTicks() - start >= (Uint32)budgetMillis) break;
+        }
+    }
+
+    void VoxelWorld::finishPendingChunks()
+    {
+        while(pendingChunks.numelems)
+        {
+            SDL_LockMutex(jobMutex);
+            while(finishedChunks.empty()) SDL_CondWait(doneCond, jobMutex);
+            SDL_UnlockMutex(jobMutex);
+            integrateFinishedChunks(INT_MAX);
+        }
+    }
+
     Block VoxelWorld::getBlock(int worldX, int worldY, int worldZ)
     {
         ChunkCoord chunkCoord;
@@ -67,6 +418,17 @@ namespace game
         return chunk->getBlock(localX, localY, localZ);
     }
 
+    bool VoxelWorld::tryGetBlock(int worldX, int worldY, int worldZ, Block &block)
+    {
+        ChunkCoord chunkCoord;
+        int localX, localY, localZ;
+        worldToLocalCoord(worldX, worldY, worldZ, chunkCoord, localX, localY, localZ);
+        Chunk *chunk = getChunk(chunkCoord);
+        if(!chunk) return false;
+        block = chunk->getBlock(localX, localY, localZ);
+        return true;
+    }
+
     void VoxelWorld::setBlock(int worldX, int worldY, int worldZ, BlockType type)
     {
         setBlock(worldX, worldY, worldZ, Block(type));
@@ -79,8 +441,61 @@ namespace game
         worldToLocalCoord(worldX, worldY, worldZ, chunkCoord, localX, localY, localZ);
         Chunk *chunk = getOrCreateChunk(chunkCoord);
         if(!chunk) return;
+        if(!Chunk::isValidCoord(localX, localY, localZ) || chunk->getBlock(localX, localY, localZ) == block) return;
         chunk->setBlock(localX, localY, localZ, block);
-        chunk->markMeshDirty();
+        markBlockDirty(chunk, localX, localY, localZ);
+        updateLight(worldX, worldY, worldZ);
+    }
+
+    void VoxelWorld::markBlockDirty(Chunk *chunk, int localX, int localY, int localZ)
+    {
+        markBoxDirty(chunk, localX, localY, localZ, localX, localY, localZ);
+    }
+
+    // Flags the sections holding a box of changed blocks, the section above or
+    // below if a block's mesh cell sits on their shared face, and the chunk
+    // sides the cells touch.
+    void VoxelWorld::markBoxDirty(Chunk *chunk, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+    {
+        if(smoothterrain)
+        {
+            markSmoothDirty(chunk, minX, minY, minZ, maxX, maxY, maxZ);
+            return;
+        }
+
+        int scale = 1 << chunk->getLod();
+        int minSection = (minY >> 4) - ((minY & 15) < scale ? 1 : 0), maxSection = (maxY >> 4) + ((maxY & 15) >= CHUNK_SIZE - scale ? 1 : 0);
+        for(int sy = minSection; sy <= maxSection; ++sy) chunk->markSectionDirty(sy);
+
+        int touched = 0;
+        if(minX < scale) touched |= 1 << CHUNK_SIDE_XNEG;
+        if(maxX >= CHUNK_SIZE - scale) touched |= 1 << CHUNK_SIDE_XPOS;
+        if(minZ < scale) touched |= 1 << CHUNK_SIDE_ZNEG;
+        if(maxZ >= CHUNK_SIZE - scale) touched |= 1 << CHUNK_SIDE_ZPOS;
+        if(!touched) return;
+
+        Chunk *neighbours[CHUNK_SIDES];
+        getNeighbours(chunk->getCoord(), neighbours);
+        loopi(CHUNK_SIDES) if(touched & (1 << i))
+        {
+            chunk->markBorderDirty(i);
+            if(neighbours[i]) neighbours[i]->markBorderDirty(i ^ 1);
+        }
+    }
+
+    // A block feeds the density of the eight lattice corners around it and
+    // the gradients a block further out, so it reaches smooth cells up to two
+    // blocks away, across section and chunk boundaries, diagonals included.
+    void VoxelWorld::markSmoothDirty(Chunk *chunk, int minX, int minY, int minZ, int maxX, int maxY, int maxZ)
+    {
+        int minSection = (minY >> 4) - ((minY & 15) < 2 ? 1 : 0), maxSection = (maxY >> 4) + ((maxY & 15) >= CHUNK_SIZE - 2 ? 1 : 0);
+        int fromX = minX < 2 ? -1 : 0, toX = maxX >= CHUNK_SIZE - 2 ? 1 : 0, fromZ = minZ < 2 ? -1 : 0, toZ = maxZ >= CHUNK_SIZE - 2 ? 1 : 0;
+        ChunkCoord coord = chunk->getCoord();
+        for(int x = fromX; x <= toX; ++x) for(int z = fromZ; z <= toZ; ++z)
+        {
+            Chunk *target = x || z ? getChunk(coord.x + x, coord.z + z) : chunk;
+            if(target) for(int sy = minSection; sy <= maxSection; ++sy) target->markSectionDirty(sy);
+        }
     }
 
     BiomeType VoxelWorld::getBiome(int worldX, int worldZ)
@@ -93,6 +508,28 @@ namespace game
         return chunk->getBiome(localX, localZ);
     }
 
+    bool VoxelWorld::tryGetBiome(int worldX, int worldZ, BiomeType &biome)
+    {
+        ChunkCoord coord;
+        int localX, localY, localZ;
+        worldToLocalCoord(worldX, 0, worldZ, coord, localX, localY, localZ);
+        Chunk *chunk = getChunk(coord);
+        if(!chunk) return false;
+        biome = chunk->getBiome(localX, localZ);
+        return true;
+    }
+
+    bool VoxelWorld::tryGetHeight(int worldX, int worldZ, int map, int &height)
+    {
+        ChunkCoord coord;
+        int localX, localY, localZ;
+        worldToLocalCoord(worldX, 0, worldZ, coord, localX, localY, localZ);
+        Chunk *chunk = getChunk(coord);
+        if(!chunk) return false;
+        height = chunk->getHeight(localX, localZ, map);
+        return true;
+    }
+
     void VoxelWorld::unloadDistantChunks(const ChunkCoord &playerChunk)
     {
         struct ChunkRemoval
@@ -101,13 +538,12 @@ namespace game
             Chunk *chunk;
         };
         vector<ChunkRemoval> toRemove;
+        // Chunks are requested within renderDistance but only dropped past the
+        // margin, so walking back and forth over the edge doesn't thrash them.
+        int unloadDistance = renderDistance + chunkunloadmargin;
         enumeratekt(chunks, ChunkCoord, coord, Chunk*, chunk,
         {
-            int dx = coord.x - playerChunk.x;
-            int dz = coord.z - playerChunk.z;
-            int adx = dx < 0 ? -dx : dx;
-            int adz = dz < 0 ? -dz : dz;
-            if(adx > renderDistance || adz > renderDistance)
+            if(!isChunkInRange(coord, playerChunk, unloadDistance))
             {
                 ChunkRemoval &removal = toRemove.add();
                 removal.coord = coord;
@@ -120,61 +556,117 @@ namespace game
             ChunkRemoval &removal = toRemove[i];
             if(removal.chunk)
             {
-                delete removal.chunk;
-                chunks.remove(removal.coord);
+                releaseChunk(removal.chunk);
+                removeChunk(removal.coord);
             }
         }
     }
 
     void VoxelWorld::generateNearbyChunks(const ChunkCoord &playerChunk)
     {
+        lastPlayerChunk = playerChunk;
         for(int dx = -renderDistance; dx <= renderDistance; ++dx)
         {
             for(int dz = -renderDistance; dz <= renderDistance; ++dz)
             {
-                ChunkCoord coord(playerChunk.x + dx, playerChunk.z + dz);
-                getOrCreateChunk(coord);
+                if(dx*dx + dz*dz <= renderDistance*renderDistance) requestChunk(ChunkCoord(playerChunk.x + dx, playerChunk.z + dz));
             }
         }
     }
 
+    // A chunk only changes level once it is a whole chunk past a threshold, so
+    // walking along one doesn't keep rebuilding the same meshes. Neighbours cull
+    // their seam faces against the cells a chunk draws, so their borders go too.
+    void VoxelWorld::updateLods(const ChunkCoord &playerChunk)
+    {
+        enumeratekt(chunks, ChunkCoord, coord, Chunk*, chunk,
+        {
+            float distance = sqrtf(chunkDistanceSquared(coord, playerChunk));
+            int level = chunk->getLod();
+            if(level >= getLodLevel(max(distance - 1, 0.0f)) && level <= getLodLevel(distance + 1)) continue;
+            chunk->setLod(getLodLevel(distance));
+            Chunk *neighbours[CHUNK_SIDES];
+            getNeighbours(coord, neighbours);
+            loopi(CHUNK_SIDES) if(neighbours[i]) neighbours[i]->markBorderDirty(i ^ 1);
+        });
+    }
+
+    void VoxelWorld::markAllMeshesDirty()
+    {
+        enumerate(chunks, Chunk*, chunk, chunk->markMeshDirty());
+    }
+
+    void VoxelWorld::getStats(VoxelWorldStats &stats)
+    {
+        stats.chunks = chunks.numelems;
+        stats.pending = pendingChunks.numelems;
+        stats.pooled = chunkPool->getFreeCount();
+        stats.vertices = stats.triangles = 0;
+        memset(stats.lods, 0, sizeof(stats.lods));
+        stats.memory = 0;
+        enumerate(chunks, Chunk*, chunk,
+        {
+            stats.lods[chunk->getLod()]++;
+            const ChunkMesh &mesh = chunk->getMesh();
+            stats.vertices += mesh.vertices.length();
+            stats.triangles += mesh.indices.length() / 3;
+            stats.memory += chunk->getMemoryUsage();
+        });
+    }
+
     void VoxelWorld::update(const vec &playerPos)
     {
         ChunkCoord playerChunk = worldToChunkCoord((int)playerPos.x, (int)playerPos.z);
 
-        if(playerChunk.x == lastPlayerChunk.x && playerChunk.z == lastPlayerChunk.z)
+        if(!playerChunkKnown || playerChunk.x != lastPlayerChunk.x || playerChunk.z != lastPlayerChunk.z)
         {
-            return;
+            playerChunkKnown = true;
+            generateNearbyChunks(playerChunk);
+            unloadDistantChunks(playerChunk);
         }
 
-        lastPlayerChunk = playerChunk;
-        generateNearbyChunks(playerChunk);
-        unloadDistantChunks(playerChunk);
+        // The camera turns even when the player stays put, so the queue is
+        // re-ranked every frame; generation itself runs on the workers, and each
+        // main thread stage below has its own time budget.
+        prioritizeJobs(playerChunk);
+
+        integrateFinishedChunks(chunkintegratetime);
+        updateLods(playerChunk);
+        remeshChunks(chunkremeshtime);
     }
 
-    void VoxelWorld::render()
+    // Fills out[] with the box's blocks, x fastest, then z, then y. Works one
+    // chunk column at a time and one section row at a time, so uniform sections
+    // are filled without decoding. Returns how many blocks fell in chunks that
+    // aren't resident; those are set to the fallback.
+    int BlockAccessor::readBox(int worldX, int worldY, int worldZ, int sizeX, int sizeY, int sizeZ, Block *out, const Block &fallback)
     {
-        enumeratekt(chunks, ChunkCoord, coord, Chunk*, chunk,
+        int missing = 0;
+        for(int z = worldZ, endZ = worldZ + sizeZ, spanZ; z < endZ; z += spanZ)
         {
-            if(!chunk->isMeshBuilt())
-            {
-                worldGen->generateChunkMesh(chunk);
-            }
-
-            const ChunkMesh &mesh = chunk->getMesh();
-            if(mesh.vertices.empty()) continue;
-
-            glBegin(GL_TRIANGLES);
-            for(int idx = 0; idx < mesh.indices.length(); ++idx)
+            int localZ = z & (CHUNK_SIZE - 1);
+            spanZ = min(CHUNK_SIZE - localZ, endZ - z);
+            for(int x = worldX, endX = worldX + sizeX, spanX; x < endX; x += spanX)
             {
-                unsigned int index = mesh.indices[idx];
-                if(index >= (unsigned int)mesh.vertices.length()) continue;
-                const vec &normal = mesh.normals[index];
-                const vec &vertex = mesh.vertices[index];
-                glNormal3f(normal.x, normal.y, normal.z);
-                glVertex3f(vertex.x + coord.x * CHUNK_SIZE, vertex.y, vertex.z + coord.z * CHUNK_SIZE);
+                int localX = x & (CHUNK_SIZE - 1);
+                spanX = min(CHUNK_SIZE - localX, endX - x);
+                Chunk *chunk = getChunk(VoxelWorld::worldToChunkCoord(x, z));
+                loopk(sizeY)
+                {
+                    int y = worldY + k;
+                    const ChunkSection *section = chunk && y >= 0 && y < CHUNK_HEIGHT ? chunk->getSection(y >> 4) : NULL;
+                    Block fill = chunk ? Block(BLOCK_AIR) : fallback;
+                    if(section && section->isUniform()) { fill = section->getBlock(0); section = NULL; }
+                    loopj(spanZ)
+                    {
+                        Block *row = &out[(k * sizeZ + z - worldZ + j) * sizeX + x - worldX];
+                        if(section) loopi(spanX) row[i] = section->getBlock(ChunkSection::toIndex(localX + i, y & 15, localZ + j));
+                        else loopi(spanX) row[i] = fill;
+                    }
+                }
+                if(!chunk) missing += spanX * spanZ * sizeY;
             }
-            glEnd();
-        });
+        }
+        return missing;
     }
 }
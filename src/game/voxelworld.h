@@ -3,18 +3,166 @@
 
 #include "chunk.h"
 #include "worldgen.h"
+#include "regionfile.h"
 
 namespace game
 {
     typedef hashtable<ChunkCoord, Chunk*> chunkmap;
 
+    extern int chunkdistance, chunkthreads, chunkintegratetime, chunkremeshtime, chunkuploadtime, chunkunloadmargin;
+
+    struct VoxelWorldStats
+    {
+        int chunks, pending, pooled;
+        int vertices, triangles;
+        int lods[MAXCHUNKLOD + 1];
+        size_t memory;
+    };
+
+    // One cell of the chunk grid, tagged with the coordinate of the chunk it
+    // currently holds.
+    struct ChunkSlot
+    {
+        ChunkCoord coord;
+        Chunk *chunk;
+    };
+
+    struct LightNode
+    {
+        int x, y, z, level;
+
+        LightNode() {}
+        LightNode(int x, int y, int z, int level = 0) : x(x), y(y), z(z), level(level) {}
+    };
+
+    // A box of blocks copied out of the world, stored x fastest, then z, then
+    // y, the layout BlockAccessor::readBox fills.
+    struct BlockTemplate
+    {
+        int sizeX, sizeY, sizeZ;
+        vector<Block> blocks;
+
+        BlockTemplate() : sizeX(0), sizeY(0), sizeZ(0) {}
+
+        bool empty() const { return blocks.empty(); }
+        const Block &get(int x, int y, int z) const { return blocks[(y * sizeZ + z) * sizeX + x]; }
+    };
+
+    enum
+    {
+        REGIONEDIT_FILL = 0,
+        REGIONEDIT_REPLACE,
+        REGIONEDIT_SPHERE,
+        REGIONEDIT_PASTE
+    };
+
+    // One bulk edit: the box it may write to and what it writes there.
+    struct RegionEdit
+    {
+        int mode;
+        int minX, minY, minZ, maxX, maxY, maxZ;
+        Block block, match;
+        int centerX, centerY, centerZ, radius;
+        const BlockTemplate *source;
+        bool skipAir;
+
+        RegionEdit(int mode) : mode(mode), minX(0), minY(0), minZ(0), maxX(-1), maxY(-1), maxZ(-1), centerX(0), centerY(0), centerZ(0), radius(0), source(NULL), skipAir(false) {}
+
+        void setBox(int x1, int y1, int z1, int x2, int y2, int z2)
+        {
+            minX = min(x1, x2); minY = min(y1, y2); minZ = min(z1, z2);
+            maxX = max(x1, x2); maxY = max(y1, y2); maxZ = max(z1, z2);
+        }
+    };
+
+    // Which blocks stop a ray: any block but air, solid blocks only (rays
+    // pass through liquids and vegetation) or opaque blocks only, the last
+    // being what sight checks want.
+    enum
+    {
+        VOXELRAY_ANY = 0,
+        VOXELRAY_SOLID,
+        VOXELRAY_OPAQUE
+    };
+
+    struct VoxelRay
+    {
+        vec origin, dir;
+        float maxDist;
+    };
+
+    // The block a ray stopped at, its cell, the face it entered through (-1
+    // if the ray started inside it) and the distance along the ray. A ray that
+    // hit nothing reports air at its full length, or, if it ran into a chunk
+    // that isn't loaded, air at the distance it got to with unloaded set.
+    struct VoxelRayHit
+    {
+        Block block;
+        int x, y, z, face;
+        float dist;
+        bool unloaded;
+
+        bool isHit() const { return block.type != BLOCK_AIR; }
+    };
+
+    class BlockAccessor;
+
+    struct ChunkJob
+    {
+        Chunk *chunk;
+        int distance;
+        bool stored;
+    };
+
     class VoxelWorld
     {
     private:
         chunkmap chunks;
+        chunkmap pendingChunks;
+        ChunkSlot *grid;
+        int gridShift, gridMask;
+        int overflowChunks;
         WorldGenerator *worldGen;
+        ChunkPool *chunkPool;
+        RegionStore *regions;
         int renderDistance;
+        // Chunks created before the first update() are ranked from the origin.
         ChunkCoord lastPlayerChunk;
+        bool playerChunkKnown;
+
+        SDL_mutex *jobMutex;
+        SDL_cond *jobCond, *doneCond;
+        vector<SDL_Thread *> workers;
+        vector<ChunkJob> queuedJobs;
+        vector<Chunk *> finishedChunks;
+        int activeJobs;
+        bool stopping;
+
+        vector<GLuint> deadBuffers;
+        vector<LightNode> lightQueue, darkQueue;
+
+        void startWorkers();
+        void stopWorkers();
+        static int runWorker(void *data);
+        void prioritizeJobs(const ChunkCoord &playerChunk);
+        void buildChunk(Chunk *chunk, bool stored);
+        void integrateChunk(Chunk *chunk);
+        Chunk *waitForChunk(const ChunkCoord &coord);
+        void releaseChunk(Chunk *chunk);
+        void flushDeadBuffers();
+        void getNeighbours(const ChunkCoord &coord, Chunk **neighbours, int count = CHUNK_SIDES);
+        int getSlotIndex(const ChunkCoord &coord) const { return ((coord.z & gridMask) << gridShift) | (coord.x & gridMask); }
+        void addChunk(Chunk *chunk);
+        void removeChunk(const ChunkCoord &coord);
+        void markBlockDirty(Chunk *chunk, int localX, int localY, int localZ);
+        void markBoxDirty(Chunk *chunk, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+        void markSmoothDirty(Chunk *chunk, int minX, int minY, int minZ, int maxX, int maxY, int maxZ);
+        int editRegion(const RegionEdit &edit);
+        void spreadLight(int channel, BlockAccessor &access);
+        void unspreadLight(int channel, BlockAccessor &access);
+        void updateLight(int worldX, int worldY, int worldZ);
+        void relightBlocks(const LightNode *blocks, int count);
+        void stitchLight(Chunk *chunk);
 
     public:
         VoxelWorld(unsigned int seed, int renderDist = 8);
@@ -29,22 +177,117 @@ namespace game
         Chunk* getOrCreateChunk(int x, int z);
 
         Block getBlock(int worldX, int worldY, int worldZ);
+        bool tryGetBlock(int worldX, int worldY, int worldZ, Block &block);
         void setBlock(int worldX, int worldY, int worldZ, BlockType type);
         void setBlock(int worldX, int worldY, int worldZ, Block block);
 
+        int fillBox(int x1, int y1, int z1, int x2, int y2, int z2, const Block &block);
+        int replaceBox(int x1, int y1, int z1, int x2, int y2, int z2, BlockType from, const Block &to);
+        int fillSphere(int centerX, int centerY, int centerZ, int radius, const Block &block);
+        int copyBox(int x1, int y1, int z1, int x2, int y2, int z2, BlockTemplate &dst);
+        int pasteTemplate(int worldX, int worldY, int worldZ, const BlockTemplate &src, bool skipAir = true);
+
+        int getLight(int worldX, int worldY, int worldZ);
+
+        bool raycast(const vec &origin, const vec &dir, float maxDist, VoxelRayHit &hit, int mode = VOXELRAY_ANY);
+        int raycast(const VoxelRay *rays, int count, VoxelRayHit *hits, int mode = VOXELRAY_ANY);
+        bool lineOfSight(const vec &from, const vec &to, int mode = VOXELRAY_OPAQUE);
+        int lineOfSight(const vec &from, const vec *targets, int count, bool *visible, int mode = VOXELRAY_OPAQUE);
+
         BiomeType getBiome(int worldX, int worldZ);
+        bool tryGetBiome(int worldX, int worldZ, BiomeType &biome);
+        bool tryGetHeight(int worldX, int worldZ, int map, int &height);
 
         void unloadDistantChunks(const ChunkCoord &playerChunk);
         void generateNearbyChunks(const ChunkCoord &playerChunk);
+        void updateLods(const ChunkCoord &playerChunk);
+        void requestChunk(const ChunkCoord &coord);
+        void integrateFinishedChunks(int budgetMillis);
+        void finishPendingChunks();
+        int getPendingChunkCount() const { return pendingChunks.numelems; }
+        void updateChunkMesh(Chunk *chunk);
+        void remeshChunks(int budgetMillis);
+        static bool isChunkInView(const ChunkCoord &coord);
+        void markAllMeshesDirty();
+        void getStats(VoxelWorldStats &stats);
 
         static ChunkCoord worldToChunkCoord(int worldX, int worldZ);
         static void worldToLocalCoord(int worldX, int worldY, int worldZ, ChunkCoord &chunk, int &localX, int &localY, int &localZ);
 
         WorldGenerator* getWorldGenerator() { return worldGen; }
+        RegionStore* getRegionStore() { return regions; }
+        ChunkPool* getChunkPool() { return chunkPool; }
         int getChunkCount() const { return chunks.numelems; }
         void clear();
     };
 
+    // Read-only block access that never generates or loads chunks: blocks in
+    // chunks that aren't resident read as the caller's fallback. The last chunk
+    // looked up is remembered, so runs of nearby reads skip the chunk lookup.
+    // The cached pointer is only good until the world next unloads chunks, so an
+    // accessor should live no longer than one query on the main thread.
+    class BlockAccessor
+    {
+    private:
+        VoxelWorld *world;
+        ChunkCoord lastCoord;
+        Chunk *lastChunk;
+        bool cached;
+
+    public:
+        BlockAccessor(VoxelWorld *world) : world(world), lastChunk(NULL), cached(false) {}
+
+        Chunk *getChunk(const ChunkCoord &coord);
+        bool tryGetBlock(int worldX, int worldY, int worldZ, Block &block);
+        Block getBlock(int worldX, int worldY, int worldZ, const Block &fallback = Block(BLOCK_AIR));
+        int readBox(int worldX, int worldY, int worldZ, int sizeX, int sizeY, int sizeZ, Block *out, const Block &fallback = Block(BLOCK_AIR));
+        void reset() { lastChunk = NULL; cached = false; }
+    };
+
+    // The grid is a toroidal window of chunk pointers indexed by coordinates
+    // modulo its size, which covers every chunk within the unload radius; the
+    // hashtable is only consulted for chunks that collided with a grid slot,
+    // i.e. ones loaded outside that window.
+    inline Chunk* VoxelWorld::getChunk(const ChunkCoord &coord)
+    {
+        const ChunkSlot &slot = grid[getSlotIndex(coord)];
+        if(slot.chunk && slot.coord == coord) return slot.chunk;
+        return overflowChunks ? chunks.find(coord, NULL) : NULL;
+    }
+
+    inline Chunk* VoxelWorld::getChunk(int x, int z)
+    {
+        return getChunk(ChunkCoord(x, z));
+    }
+
+    inline Chunk* BlockAccessor::getChunk(const ChunkCoord &coord)
+    {
+        if(!cached || !(lastCoord == coord))
+        {
+            lastCoord = coord;
+            lastChunk = world->getChunk(coord);
+            cached = true;
+        }
+        return lastChunk;
+    }
+
+    inline bool BlockAccessor::tryGetBlock(int worldX, int worldY, int worldZ, Block &block)
+    {
+        ChunkCoord coord;
+        int localX, localY, localZ;
+        VoxelWorld::worldToLocalCoord(worldX, worldY, worldZ, coord, localX, localY, localZ);
+        Chunk *chunk = getChunk(coord);
+        if(!chunk) return false;
+        block = chunk->getBlock(localX, localY, localZ);
+        return true;
+    }
+
+    inline Block BlockAccessor::getBlock(int worldX, int worldY, int worldZ, const Block &fallback)
+    {
+        Block block;
+        return tryGetBlock(worldX, worldY, worldZ, block) ? block : fallback;
+    }
+
     inline ChunkCoord VoxelWorld::worldToChunkCoord(int worldX, int worldZ)
     {
         int chunkX = worldX >= 0 ? worldX / CHUNK_SIZE : (worldX - CHUNK_SIZE + 1) / CHUNK_SIZE;
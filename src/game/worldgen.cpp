@@ -5,9 +5,28 @@
 
 namespace game
 {
+    VARP(noiselattice, 0, 0, 1);
+    VARP(noiselatticexz, 1, 4, 16);
+    VARP(noiselatticey, 1, 8, 64);
+    VARP(wormcaves, 0, 0, 7);
+    VARP(climatelattice, 0, 0, 1);
+    VARP(biomeblend, 0, 0, MAX_BIOME_BLEND);
+
+    const char * const genStageNames[GENSTAGE_COUNT] = { "columns", "carvers", "terrain", "ores", "vegetation", "sky islands", "kithgard", "light", "mesh" };
+
+    static inline llong getStageClock()
+    {
+        static const double nanosPerTick = 1e9 / SDL_GetPerformanceFrequency();
+        return llong(SDL_GetPerformanceCounter() * nanosPerTick);
+    }
+
     WorldGenerator::WorldGenerator(unsigned int worldSeed) : seed(worldSeed)
     {
         noiseGen = new NoiseGenerator(seed);
+        caveCarver = new CaveCarver(seed);
+        statsMutex = SDL_CreateMutex();
+        resetStats();
+        ChunkSection::init();
         BiomeManager::init();
         VegetationManager::init();
         WorldLayerManager::init();
@@ -16,30 +35,245 @@ namespace game
     WorldGenerator::~WorldGenerator()
     {
         delete noiseGen;
+        delete caveCarver;
+        SDL_DestroyMutex(statsMutex);
     }
 
-    double WorldGenerator::getTerrainHeight(int worldX, int worldZ)
+    void WorldGenerator::getStats(WorldGenStats &out)
+    {
+        SDL_LockMutex(statsMutex);
+        out = stats;
+        SDL_UnlockMutex(statsMutex);
+    }
+
+    void WorldGenerator::resetStats()
+    {
+        SDL_LockMutex(statsMutex);
+        memset(&stats, 0, sizeof(stats));
+        SDL_UnlockMutex(statsMutex);
+    }
+
+    static inline void setColumnBiome(ColumnClimate &column)
+    {
+        column.biome = BiomeManager::selectBiome(column.continentalness, column.erosion, column.peaks, column.temperature, column.humidity, column.weirdness);
+        const BiomeData &biomeData = BiomeManager::getBiome(column.biome);
+        column.baseHeight = biomeData.baseHeight;
+        column.heightVariation = biomeData.heightVariation;
+    }
+
+    static inline int getClimateCell(int worldPos)
+    {
+        return worldPos >= 0 ? worldPos / CLIMATE_STEP : (worldPos + 1) / CLIMATE_STEP - 1;
+    }
+
+    template<class T>
+    static inline double bilerpLattice(const T *field, int index, int size, double fx, double fz)
+    {
+        double top = field[index] + (field[index + 1] - field[index]) * fx;
+        double bottom = field[index + size] + (field[index + size + 1] - field[index + size]) * fx;
+        return top + (bottom - top) * fz;
+    }
+
+    void ClimateLattice::interpolateClimate(int worldX, int worldZ, ColumnClimate &column) const
+    {
+        int cellX = getClimateCell(worldX), cellZ = getClimateCell(worldZ);
+        int index = (cellZ - originZ) * size + cellX - originX;
+        double fx = double(worldX - cellX * CLIMATE_STEP) / CLIMATE_STEP, fz = double(worldZ - cellZ * CLIMATE_STEP) / CLIMATE_STEP;
+        column.continentalness = bilerpLattice(fields[CLIMATE_CONTINENTALNESS], index, size, fx, fz);
+        column.erosion = bilerpLattice(fields[CLIMATE_EROSION], index, size, fx, fz);
+        column.peaks = bilerpLattice(fields[CLIMATE_PEAKS], index, size, fx, fz);
+        column.temperature = bilerpLattice(fields[CLIMATE_TEMPERATURE], index, size, fx, fz);
+        column.humidity = bilerpLattice(fields[CLIMATE_HUMIDITY], index, size, fx, fz);
+        column.weirdness = bilerpLattice(fields[CLIMATE_WEIRDNESS], index, size, fx, fz);
+        column.skyContinentalness = bilerpLattice(fields[CLIMATE_SKY_CONTINENTALNESS], index, size, fx, fz);
+        column.skyErosion = bilerpLattice(fields[CLIMATE_SKY_EROSION], index, size, fx, fz);
+        column.skyPeaks = bilerpLattice(fields[CLIMATE_SKY_PEAKS], index, size, fx, fz);
+    }
+
+    void ClimateLattice::interpolateHeights(int worldX, int worldZ, ColumnClimate &column) const
+    {
+        int cellX = getClimateCell(worldX), cellZ = getClimateCell(worldZ);
+        int index = (cellZ - originZ) * size + cellX - originX;
+        double fx = double(worldX - cellX * CLIMATE_STEP) / CLIMATE_STEP, fz = double(worldZ - cellZ * CLIMATE_STEP) / CLIMATE_STEP;
+        column.baseHeight = bilerpLattice(baseHeight, index, size, fx, fz);
+        column.heightVariation = bilerpLattice(heightVariation, index, size, fx, fz);
+    }
+
+    // Evaluates the six climate fields at (x, z) and the three density ones the
+    // sky layer reads at (x/2, z/2), in the order of the CLIMATE_* enum.
+    void WorldGenerator::sampleClimate(const float *x, const float *z, float *const *fields, int count)
+    {
+        float skyx[CHUNK_SIZE * CHUNK_SIZE], skyz[CHUNK_SIZE * CHUNK_SIZE];
+        for(int i = 0; i < count; ++i)
+        {
+            skyx[i] = x[i] * 0.5f;
+            skyz[i] = z[i] * 0.5f;
+        }
+        noiseGen->getContinentalness(x, z, fields[CLIMATE_CONTINENTALNESS], count);
+        noiseGen->getErosion(x, z, fields[CLIMATE_EROSION], count);
+        noiseGen->getPeaksValleys(x, z, fields[CLIMATE_PEAKS], count);
+        noiseGen->getTemperature(x, z, fields[CLIMATE_TEMPERATURE], count);
+        noiseGen->getHumidity(x, z, fields[CLIMATE_HUMIDITY], count);
+        noiseGen->getWeirdness(x, z, fields[CLIMATE_WEIRDNESS], count);
+        noiseGen->getContinentalness(skyx, skyz, fields[CLIMATE_SKY_CONTINENTALNESS], count);
+        noiseGen->getErosion(skyx, skyz, fields[CLIMATE_SKY_EROSION], count);
+        noiseGen->getPeaksValleys(skyx, skyz, fields[CLIMATE_SKY_PEAKS], count);
+    }
+
+    void WorldGenerator::sampleClimateLattice(int originX, int originZ, int size, int blend, ClimateLattice &lattice)
+    {
+        lattice.originX = originX;
+        lattice.originZ = originZ;
+        lattice.size = size;
+
+        int count = size * size;
+        float xs[ClimateLattice::MAX_SIZE * ClimateLattice::MAX_SIZE], zs[ClimateLattice::MAX_SIZE * ClimateLattice::MAX_SIZE];
+        for(int i = 0; i < count; ++i)
+        {
+            xs[i] = (originX + i % size) * CLIMATE_STEP;
+            zs[i] = (originZ + i / size) * CLIMATE_STEP;
+        }
+        float *fields[NUM_CLIMATE_FIELDS];
+        loopi(NUM_CLIMATE_FIELDS) fields[i] = lattice.fields[i];
+        sampleClimate(xs, zs, fields, count);
+
+        for(int i = 0; i < count; ++i)
+        {
+            ColumnClimate point;
+            point.continentalness = lattice.fields[CLIMATE_CONTINENTALNESS][i];
+            point.erosion = lattice.fields[CLIMATE_EROSION][i];
+            point.peaks = lattice.fields[CLIMATE_PEAKS][i];
+            point.temperature = lattice.fields[CLIMATE_TEMPERATURE][i];
+            point.humidity = lattice.fields[CLIMATE_HUMIDITY][i];
+            point.weirdness = lattice.fields[CLIMATE_WEIRDNESS][i];
+            setColumnBiome(point);
+            lattice.baseHeight[i] = point.baseHeight;
+            lattice.heightVariation[i] = point.heightVariation;
+        }
+        if(blend <= 0) return;
+
+        // Box filter the height terms of the inner points; the rest are only
+        // there to be read by it.
+        double baseHeight[ClimateLattice::MAX_SIZE * ClimateLattice::MAX_SIZE], heightVariation[ClimateLattice::MAX_SIZE * ClimateLattice::MAX_SIZE];
+        double weight = 1.0 / ((2 * blend + 1) * (2 * blend + 1));
+        for(int z = blend; z < size - blend; ++z) for(int x = blend; x < size - blend; ++x)
+        {
+            double base = 0, variation = 0;
+            for(int dz = -blend; dz <= blend; ++dz) for(int dx = -blend; dx <= blend; ++dx)
+            {
+                base += lattice.baseHeight[(z + dz) * size + x + dx];
+                variation += lattice.heightVariation[(z + dz) * size + x + dx];
+            }
+            baseHeight[z * size + x] = base * weight;
+            heightVariation[z * size + x] = variation * weight;
+        }
+        for(int z = blend; z < size - blend; ++z) for(int x = blend; x < size - blend; ++x)
+        {
+            lattice.baseHeight[z * size + x] = baseHeight[z * size + x];
+            lattice.heightVariation[z * size + x] = heightVariation[z * size + x];
+        }
+    }
+
+    void WorldGenerator::sampleColumn(int worldX, int worldZ, ColumnClimate &column)
+    {
+        int blend = clamp(biomeblend, 0, MAX_BIOME_BLEND);
+        ClimateLattice lattice;
+        if(climatelattice || blend) sampleClimateLattice(getClimateCell(worldX) - blend, getClimateCell(worldZ) - blend, 2 + 2 * blend, blend, lattice);
+
+        if(climatelattice) lattice.interpolateClimate(worldX, worldZ, column);
+        else
+        {
+            column.continentalness = noiseGen->getContinentalness(worldX, worldZ);
+            column.erosion = noiseGen->getErosion(worldX, worldZ);
+            column.peaks = noiseGen->getPeaksValleys(worldX, worldZ);
+            column.temperature = noiseGen->getTemperature(worldX, worldZ);
+            column.humidity = noiseGen->getHumidity(worldX, worldZ);
+            column.weirdness = noiseGen->getWeirdness(worldX, worldZ);
+            column.skyContinentalness = noiseGen->getContinentalness(worldX * 0.5, worldZ * 0.5);
+            column.skyErosion = noiseGen->getErosion(worldX * 0.5, worldZ * 0.5);
+            column.skyPeaks = noiseGen->getPeaksValleys(worldX * 0.5, worldZ * 0.5);
+        }
+        setColumnBiome(column);
+        if(blend) lattice.interpolateHeights(worldX, worldZ, column);
+        column.terrainHeight = getTerrainHeight(column);
+    }
+
+    // Samples CHUNK_SIZE x CHUNK_SIZE columns spacing apart from (worldX, worldZ),
+    // a chunk's worth with spacing 1. The climate fields change over hundreds of
+    // columns, so with interpolate (climatelattice when generating) they are
+    // interpolated from a lattice point every CLIMATE_STEP columns instead of
+    // being evaluated per column.
+    // biomeblend interpolates the biome height terms from that lattice too, so
+    // terrain ramps between biomes instead of stepping. Wider spacings, only
+    // used for previews, evaluate every column and skip the blending.
+    void WorldGenerator::sampleColumns(int worldX, int worldZ, int spacing, bool interpolate, ChunkColumns &columns)
     {
-        double cont = noiseGen->getContinentalness(worldX, worldZ);
-        double erosion = noiseGen->getErosion(worldX, worldZ);
-        double peaks = noiseGen->getPeaksValleys(worldX, worldZ);
-        double temp = noiseGen->getTemperature(worldX, worldZ);
-        double humid = noiseGen->getHumidity(worldX, worldZ);
-        double weirdness = noiseGen->getWeirdness(worldX, worldZ);
+        enum { NUM_COLUMNS = CHUNK_SIZE * CHUNK_SIZE };
+        if(spacing != 1) interpolate = false;
+        int blend = spacing == 1 ? clamp(biomeblend, 0, MAX_BIOME_BLEND) : 0;
 
-        BiomeType biome = BiomeManager::selectBiome(cont, erosion, peaks, temp, humid, weirdness);
-        const BiomeData &biomeData = BiomeManager::getBiome(biome);
+        ClimateLattice lattice;
+        if(interpolate || blend)
+        {
+            sampleClimateLattice(getClimateCell(worldX) - blend, getClimateCell(worldZ) - blend, CHUNK_SIZE / CLIMATE_STEP + 1 + 2 * blend + (worldX % CLIMATE_STEP || worldZ % CLIMATE_STEP ? 1 : 0), blend, lattice);
+        }
 
-        double baseHeight = biomeData.baseHeight;
-        double heightVar = biomeData.heightVariation;
+        float fields[NUM_CLIMATE_FIELDS][NUM_COLUMNS];
+        if(!interpolate)
+        {
+            float xs[NUM_COLUMNS], zs[NUM_COLUMNS];
+            for(int i = 0; i < NUM_COLUMNS; ++i)
+            {
+                xs[i] = worldX + (i % CHUNK_SIZE) * spacing;
+                zs[i] = worldZ + (i / CHUNK_SIZE) * spacing;
+            }
+            float *out[NUM_CLIMATE_FIELDS];
+            loopi(NUM_CLIMATE_FIELDS) out[i] = fields[i];
+            sampleClimate(xs, zs, out, NUM_COLUMNS);
+        }
+
+        for(int i = 0; i < NUM_COLUMNS; ++i)
+        {
+            int columnX = worldX + i % CHUNK_SIZE, columnZ = worldZ + i / CHUNK_SIZE;
+            ColumnClimate &column = columns.columns[i];
+            if(interpolate) lattice.interpolateClimate(columnX, columnZ, column);
+            else
+            {
+                column.continentalness = fields[CLIMATE_CONTINENTALNESS][i];
+                column.erosion = fields[CLIMATE_EROSION][i];
+                column.peaks = fields[CLIMATE_PEAKS][i];
+                column.temperature = fields[CLIMATE_TEMPERATURE][i];
+                column.humidity = fields[CLIMATE_HUMIDITY][i];
+                column.weirdness = fields[CLIMATE_WEIRDNESS][i];
+                column.skyContinentalness = fields[CLIMATE_SKY_CONTINENTALNESS][i];
+                column.skyErosion = fields[CLIMATE_SKY_EROSION][i];
+                column.skyPeaks = fields[CLIMATE_SKY_PEAKS][i];
+            }
+            setColumnBiome(column);
+            if(blend) lattice.interpolateHeights(columnX, columnZ, column);
+            column.terrainHeight = getTerrainHeight(column);
+        }
+    }
+
+    double WorldGenerator::getTerrainHeight(const ColumnClimate &column)
+    {
+        double baseHeight = column.baseHeight;
+        double heightVar = column.heightVariation;
 
-        double height = baseHeight + peaks * heightVar * 0.5;
-        height -= erosion * heightVar * 0.3;
-        height += weirdness * 5.0;
+        double height = baseHeight + column.peaks * heightVar * 0.5;
+        height -= column.erosion * heightVar * 0.3;
+        height += column.weirdness * 5.0;
 
         return height + WORLD_SEA_LEVEL;
     }
 
+    double WorldGenerator::getTerrainHeight(int worldX, int worldZ)
+    {
+        ColumnClimate column;
+        sampleColumn(worldX, worldZ, column);
+        return column.terrainHeight;
+    }
+
     double WorldGenerator::getSurfaceDensity(int worldX, int worldY, int worldZ)
     {
         double terrainHeight = getTerrainHeight(worldX, worldZ);
@@ -51,47 +285,221 @@ namespace game
         return density;
     }
 
-    bool WorldGenerator::isCave(int worldX, int worldY, int worldZ)
+    void NoiseLattice::setup(int stepxz, int stepy, int miny, int maxy)
+    {
+        stepXZ = stepxz;
+        stepY = stepy;
+        minY = miny;
+        maxY = maxy;
+        pointsXZ = (CHUNK_SIZE + stepXZ - 1) / stepXZ + 1;
+        pointsY = (maxY - minY + stepY - 1) / stepY + 1;
+        values.setsize(0);
+        values.pad(pointsXZ * pointsXZ * pointsY);
+    }
+
+    float NoiseLattice::get(int x, int y, int z) const
+    {
+        int cx = x / stepXZ, cz = z / stepXZ, cy = min((y - minY) / stepY, pointsY - 2);
+        float x0 = getPosXZ(cx), z0 = getPosXZ(cz), y0 = getPosY(cy);
+        float fx = (x - x0) / (getPosXZ(cx + 1) - x0);
+        float fz = (z - z0) / (getPosXZ(cz + 1) - z0);
+        float fy = (y - y0) / (getPosY(cy + 1) - y0);
+
+        const float *p = &values[(cy * pointsXZ + cz) * pointsXZ + cx];
+        int dz = pointsXZ, dy = pointsXZ * pointsXZ;
+        float c00 = p[0] + (p[1] - p[0]) * fx;
+        float c01 = p[dz] + (p[dz + 1] - p[dz]) * fx;
+        float c10 = p[dy] + (p[dy + 1] - p[dy]) * fx;
+        float c11 = p[dy + dz] + (p[dy + dz + 1] - p[dy + dz]) * fx;
+        float c0 = c00 + (c01 - c00) * fz;
+        float c1 = c10 + (c11 - c10) * fz;
+        return c0 + (c1 - c0) * fy;
+    }
+
+    // Density fields take their 2D terms from the column; without one they are
+    // left out, which is how the lattices store them (the terms are added back
+    // per column after interpolation).
+    void WorldGenerator::evaluateField(int field, const float *x, const float *y, const float *z, float *out, int count, const ColumnClimate *column)
+    {
+        switch(field)
+        {
+            case FIELD_CAVE_SPAGHETTI: noiseGen->getCaveSpaghetti(x, y, z, out, count); break;
+            case FIELD_CAVE_CHEESE: noiseGen->getCaveCheese(x, y, z, out, count); break;
+            case FIELD_CAVE_NOISE: noiseGen->getCaveNoise(x, y, z, out, count); break;
+            case FIELD_DENSITY:
+                if(column) noiseGen->getDensity(x, y, z, out, count, column->continentalness, column->erosion, column->peaks);
+                else noiseGen->getDensity(x, y, z, out, count, 0, 0, 0);
+                break;
+            case FIELD_SKY_DENSITY:
+                if(column) noiseGen->getDensity(x, y, z, out, count, column->skyContinentalness, column->skyErosion, column->skyPeaks);
+                else noiseGen->getDensity(x, y, z, out, count, 0, 0, 0);
+                break;
+        }
+    }
+
+    void WorldGenerator::sampleField(int field, const ColumnSamples &samples, int first, int count, float *out, const ColumnClimate &column)
     {
-        WorldLayer layer = WorldLayerManager::getWorldLayer(worldY);
-        if(layer != LAYER_CAVES && layer != LAYER_SURFACE) return false;
+        if(!samples.lattices)
+        {
+            evaluateField(field, samples.x + first, samples.y + first, samples.z + first, out, count, &column);
+            return;
+        }
 
-        double spaghettiCave = noiseGen->getCaveSpaghetti(worldX, worldY, worldZ);
-        if(fabs(spaghettiCave) < 0.03) return true;
+        float offset = 0;
+        if(field == FIELD_DENSITY) offset = float(column.peaks * 0.35 - column.erosion * 0.2 + column.continentalness * 0.5);
+        else if(field == FIELD_SKY_DENSITY) offset = float(column.skyPeaks * 0.35 - column.skyErosion * 0.2 + column.skyContinentalness * 0.5);
+        const NoiseLattice &lattice = samples.lattices[field];
+        for(int i = 0; i < count; ++i) out[i] = lattice.get(samples.localX, samples.index[first + i], samples.localZ) + offset;
+    }
+
+    void WorldGenerator::sampleLattice(const ChunkCoord &coord, int field, NoiseLattice &lattice)
+    {
+        static const int fieldRanges[NUM_NOISE_FIELDS][2] =
+        {
+            { WORLD_KITHGARD_MIN, WORLD_SURFACE_MAX },
+            { WORLD_CAVES_MIN, WORLD_SURFACE_MAX },
+            { WORLD_CAVES_MIN, WORLD_SURFACE_MAX },
+            { WORLD_KITHGARD_MIN, WORLD_KITHGARD_MAX },
+            { WORLD_SKIES_MIN, CHUNK_HEIGHT - 1 }
+        };
+        lattice.setup(noiselatticexz, noiselatticey, fieldRanges[field][0], fieldRanges[field][1]);
+
+        // Sky islands sample their density at half the world coordinates.
+        float scale = field == FIELD_SKY_DENSITY ? 0.5f : 1.0f;
+        vector<float> xs, ys, zs;
+        for(int j = 0; j < lattice.pointsY; ++j)
+        {
+            for(int k = 0; k < lattice.pointsXZ; ++k)
+            {
+                for(int i = 0; i < lattice.pointsXZ; ++i)
+                {
+                    xs.add((coord.x * CHUNK_SIZE + lattice.getPosXZ(i)) * scale);
+                    ys.add(lattice.getPosY(j) * scale);
+                    zs.add((coord.z * CHUNK_SIZE + lattice.getPosXZ(k)) * scale);
+                }
+            }
+        }
+        evaluateField(field, xs.getbuf(), ys.getbuf(), zs.getbuf(), lattice.values.getbuf(), xs.length(), NULL);
+    }
 
-        double cheeseCave = noiseGen->getCaveCheese(worldX, worldY, worldZ);
-        if(cheeseCave > 0.6) return true;
+    // Octave simplex noise stays within about +-0.98; the margin covers float
+    // rounding in the batched kernels.
+    static const float NOISE_BOUND = 1.05f;
 
-        double noiseCave = noiseGen->getCaveNoise(worldX, worldY, worldZ);
-        if(noiseCave > 0.65) return true;
+    // Marks air above the terrain and caves below it in the cave and surface
+    // layers. Only voxels under the terrain need any noise, and none at all in
+    // layers that take their caves from the worm carvers.
+    void WorldGenerator::findCaves(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, const CarveMask *carved, bool *open, int *evaluated)
+    {
+        samples.reset();
+        for(int y = WORLD_CAVES_MIN; y <= WORLD_SURFACE_MAX; ++y)
+        {
+            open[y] = y > column.terrainHeight;
+            if(open[y]) continue;
+            if(carved && carved->hasLayer(y < WORLD_SURFACE_MIN ? LAYER_CAVES : LAYER_SURFACE)) open[y] = carved->isCarved(samples.localX, y, samples.localZ);
+            else samples.add(worldX, y, worldZ, y);
+        }
+        if(!samples.count) return;
 
-        return false;
+        sampleField(FIELD_CAVE_SPAGHETTI, samples, 0, samples.count, samples.a, column);
+        sampleField(FIELD_CAVE_CHEESE, samples, 0, samples.count, samples.b, column);
+        sampleField(FIELD_CAVE_NOISE, samples, 0, samples.count, samples.c, column);
+        for(int i = 0; i < samples.count; ++i)
+        {
+            int y = samples.index[i];
+            if(fabs(samples.a[i]) < 0.03f || samples.b[i] > 0.6f || samples.c[i] > 0.65f) open[y] = true;
+            evaluated[y < WORLD_SURFACE_MIN ? LAYER_CAVES : LAYER_SURFACE]++;
+        }
     }
 
-    bool WorldGenerator::isKithgardCave(int worldX, int worldY, int worldZ)
+    // Kithgard density falls off linearly with height around bounded noise, so
+    // near the bottom it is certainly above the cave threshold and near the top
+    // certainly below it; only the band in between needs the density field.
+    void WorldGenerator::findKithgardCaves(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, const CarveMask *carved, bool *open, int *evaluated)
     {
-        WorldLayer layer = WorldLayerManager::getWorldLayer(worldY);
-        if(layer != LAYER_KITHGARD) return false;
+        float offset = float(column.peaks * 0.35 - column.erosion * 0.2 + column.continentalness * 0.5);
+        float threshold = 0.3f + column.weirdness * 0.3f;
+        int bandMin = WORLD_KITHGARD_MIN, bandMax = WORLD_KITHGARD_MAX + 1;
+        while(bandMin <= WORLD_KITHGARD_MAX && offset - (bandMin - 64) * 0.015f - NOISE_BOUND > threshold) open[bandMin++] = true;
+        while(bandMax > bandMin && offset - (bandMax - 1 - 64) * 0.015f + NOISE_BOUND <= threshold) bandMax--;
+
+        samples.reset();
+        for(int y = bandMin; y < bandMax; ++y) samples.add(worldX, y, worldZ, y);
+        sampleField(FIELD_DENSITY, samples, 0, samples.count, samples.a, column);
+
+        // Worm carvers stand in for the spaghetti test when they are on.
+        int first = samples.count;
+        if(carved && carved->hasLayer(LAYER_KITHGARD))
+        {
+            for(int i = 0; i < first; ++i)
+            {
+                int y = samples.index[i];
+                open[y] = samples.a[i] > threshold || carved->isCarved(samples.localX, y, samples.localZ);
+            }
+            for(int y = bandMax; y <= WORLD_KITHGARD_MAX; ++y) open[y] = carved->isCarved(samples.localX, y, samples.localZ);
+            evaluated[LAYER_KITHGARD] += bandMax - bandMin;
+            return;
+        }
 
-        double kithgardNoise = noiseGen->getDensity(worldX, worldY, worldZ);
-        double weird = noiseGen->getWeirdness(worldX, worldZ);
-        
-        double threshold = 0.3 + (weird * 0.3);
-        if(kithgardNoise > threshold) return true;
+        // Whatever is still solid needs the spaghetti test; it is appended after
+        // the density points, so sample that tail.
+        for(int i = 0; i < first; ++i)
+        {
+            int y = samples.index[i];
+            open[y] = samples.a[i] > threshold;
+            if(!open[y]) samples.add(worldX, y, worldZ, y);
+        }
+        for(int y = bandMax; y <= WORLD_KITHGARD_MAX; ++y)
+        {
+            open[y] = false;
+            samples.add(worldX, y, worldZ, y);
+        }
 
-        double spaghettiCave = noiseGen->getCaveSpaghetti(worldX, worldY, worldZ);
-        if(fabs(spaghettiCave) < 0.05) return true;
+        int remaining = samples.count - first;
+        sampleField(FIELD_CAVE_SPAGHETTI, samples, first, remaining, samples.b, column);
+        for(int i = 0; i < remaining; ++i)
+        {
+            if(fabs(samples.b[i]) < 0.05f) open[samples.index[first + i]] = true;
+        }
+        evaluated[LAYER_KITHGARD] += WORLD_KITHGARD_MAX + 1 - bandMin;
+    }
 
-        return false;
+    // Islands start at a fixed height per column and their density only loses
+    // ground against the threshold with altitude, so the candidates form one
+    // vertical run. Returns the top of that run, or -1 if there is none.
+    int WorldGenerator::findSkyIslands(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, bool *open, int *evaluated)
+    {
+        for(int y = WORLD_SKIES_MIN; y < CHUNK_HEIGHT; ++y) open[y] = true;
+
+        float offset = float(column.skyPeaks * 0.35 - column.skyErosion * 0.2 + column.skyContinentalness * 0.5);
+        samples.reset();
+        for(int y = WorldLayerManager::getFloatingIslandBase(worldX, worldZ, seed, CHUNK_HEIGHT - 1); y < CHUNK_HEIGHT; ++y)
+        {
+            float threshold = 0.6f - min((y - WORLD_SKIES_MIN) / 512.0f, 0.4f);
+            if(offset - (y * 0.5f - 64) * 0.015f + NOISE_BOUND <= threshold) break;
+            samples.add(worldX * 0.5f, y * 0.5f, worldZ * 0.5f, y);
+        }
+        if(!samples.count) return -1;
+
+        sampleField(FIELD_SKY_DENSITY, samples, 0, samples.count, samples.a, column);
+        for(int i = 0; i < samples.count; ++i)
+        {
+            int y = samples.index[i];
+            float threshold = 0.6f - min((y - WORLD_SKIES_MIN) / 512.0f, 0.4f);
+            if(samples.a[i] > threshold) open[y] = false;
+        }
+        evaluated[LAYER_SKIES] += samples.count;
+        return samples.index[samples.count - 1];
     }
 
-    BlockType WorldGenerator::selectBlockType(int worldX, int worldY, int worldZ, BiomeType biome, double surfaceDistance, WorldLayer layer)
+    BlockType WorldGenerator::selectBlockType(int worldX, int worldY, int worldZ, const ColumnClimate &column, double surfaceDistance, WorldLayer layer)
     {
+        BiomeType biome = column.biome;
         if(layer == LAYER_KITHGARD)
         {
             if(worldY <= WORLD_KITHGARD_MIN + 1) return BLOCK_BEDROCK;
             
-            double weird = noiseGen->getWeirdness(worldX, worldZ);
+            double weird = column.weirdness;
             if(surfaceDistance < -5.0)
             {
                 if(weird > 0.6) return BLOCK_KITHGARD_CRYSTAL;
@@ -164,6 +572,43 @@ namespace game
         int chunkWorldX = coord.x * CHUNK_SIZE;
         int chunkWorldZ = coord.z * CHUNK_SIZE;
 
+        llong stageTime[GENSTAGE_COUNT];
+        llong stageStart = getStageClock();
+        #define ENDSTAGE(stage) do { llong stageEnd = getStageClock(); stageTime[stage] = stageEnd - stageStart; stageStart = stageEnd; } while(0)
+
+        ChunkColumns columns;
+        sampleColumns(chunkWorldX, chunkWorldZ, 1, climatelattice != 0, columns);
+        loopi(CHUNK_SIZE * CHUNK_SIZE) chunk->setBiome(i % CHUNK_SIZE, i / CHUNK_SIZE, columns.columns[i].biome);
+        ENDSTAGE(GENSTAGE_COLUMNS);
+
+        int wormLayers = wormcaves & ((1 << LAYER_SKIES) - 1);
+        CarveMask *carved = NULL;
+        if(wormLayers)
+        {
+            carved = new CarveMask;
+            carved->reset(wormLayers);
+            caveCarver->carveChunk(coord, *carved);
+        }
+        ENDSTAGE(GENSTAGE_CARVERS);
+
+        NoiseLattice *lattices = NULL;
+        if(noiselattice)
+        {
+            // Cave fields are only needed by layers still using noise caves.
+            int noiseCaveLayers = ~wormLayers & ((1 << LAYER_CAVES) | (1 << LAYER_SURFACE));
+            lattices = new NoiseLattice[NUM_NOISE_FIELDS];
+            loopi(NUM_NOISE_FIELDS)
+            {
+                if(i == FIELD_CAVE_SPAGHETTI && !noiseCaveLayers && wormLayers & (1 << LAYER_KITHGARD)) continue;
+                if((i == FIELD_CAVE_CHEESE || i == FIELD_CAVE_NOISE) && !noiseCaveLayers) continue;
+                sampleLattice(coord, i, lattices[i]);
+            }
+        }
+
+        ColumnSamples *samples = new ColumnSamples;
+        samples->lattices = lattices;
+        bool open[CHUNK_HEIGHT];
+        int evaluated[LAYER_COUNT] = { 0 };
         for(int x = 0; x < CHUNK_SIZE; ++x)
         {
             for(int z = 0; z < CHUNK_SIZE; ++z)
@@ -171,58 +616,28 @@ namespace game
                 int worldX = chunkWorldX + x;
                 int worldZ = chunkWorldZ + z;
 
-                double cont = noiseGen->getContinentalness(worldX, worldZ);
-                double erosion = noiseGen->getErosion(worldX, worldZ);
-                double peaks = noiseGen->getPeaksValleys(worldX, worldZ);
-                double temp = noiseGen->getTemperature(worldX, worldZ);
-                double humid = noiseGen->getHumidity(worldX, worldZ);
-                double weirdness = noiseGen->getWeirdness(worldX, worldZ);
-
-                BiomeType biome = BiomeManager::selectBiome(cont, erosion, peaks, temp, humid, weirdness);
-                chunk->setBiome(x, z, biome);
+                const ColumnClimate &column = columns.get(x, z);
+                BiomeType biome = column.biome;
+                double terrainHeight = column.terrainHeight;
 
-                double terrainHeight = getTerrainHeight(worldX, worldZ);
+                samples->localX = x;
+                samples->localZ = z;
+                findKithgardCaves(worldX, worldZ, column, *samples, carved, open, evaluated);
+                findCaves(worldX, worldZ, column, *samples, carved, open, evaluated);
+                int islandTop = findSkyIslands(worldX, worldZ, column, *samples, open, evaluated);
 
-                for(int y = 0; y < CHUNK_HEIGHT; ++y)
+                // Nothing above the terrain, the sea and any island run can be
+                // anything but air, which the chunk already holds.
+                int top = max(max(int(terrainHeight), WORLD_SEA_LEVEL - 1), islandTop);
+                for(int y = 0; y <= top; ++y)
                 {
                     int worldY = y;
                     WorldLayer layer = WorldLayerManager::getWorldLayer(worldY);
                     double surfaceDistance = terrainHeight - worldY;
+                    if(layer == LAYER_SKIES) surfaceDistance = (double)(WORLD_SKIES_MIN - worldY);
+                    else if(layer == LAYER_KITHGARD) surfaceDistance = (double)(WORLD_KITHGARD_MAX - worldY);
 
-                    bool isAir = false;
-                    bool cave = false;
-
-                    if(layer == LAYER_SKIES)
-                    {
-                        bool island = WorldLayerManager::isFloatingIsland(worldX, worldY, worldZ, seed);
-                        double density = noiseGen->getDensity(worldX * 0.5, worldY * 0.5, worldZ * 0.5);
-                        double altFactor = (worldY - WORLD_SKIES_MIN) / 512.0;
-                        if(altFactor > 0.4) altFactor = 0.4;
-                        double threshold = 0.6 - altFactor;
-                        if(island && density > threshold)
-                        {
-                            isAir = false;
-                            cave = false;
-                            surfaceDistance = (double)(WORLD_SKIES_MIN - worldY);
-                        }
-                        else
-                        {
-                            isAir = true;
-                        }
-                    }
-                    else if(layer == LAYER_KITHGARD)
-                    {
-                        isAir = false;
-                        cave = isKithgardCave(worldX, worldY, worldZ);
-                        surfaceDistance = (double)(WORLD_KITHGARD_MAX - worldY);
-                    }
-                    else
-                    {
-                        isAir = worldY > terrainHeight;
-                        cave = !isAir && isCave(worldX, worldY, worldZ);
-                    }
-
-                    if(isAir || cave)
+                    if(open[y])
                     {
                         if(layer == LAYER_KITHGARD && worldY < WORLD_KITHGARD_MIN + 100)
                         {
@@ -247,38 +662,60 @@ namespace game
                     }
                     else
                     {
-                        BlockType blockType = selectBlockType(worldX, worldY, worldZ, biome, surfaceDistance, layer);
+                        BlockType blockType = selectBlockType(worldX, worldY, worldZ, column, surfaceDistance, layer);
                         chunk->setBlock(x, y, z, blockType);
                     }
                 }
             }
         }
 
+        delete samples;
+        delete[] lattices;
+        delete carved;
+        ENDSTAGE(GENSTAGE_TERRAIN);
+
         generateOres(chunk);
-        generateVegetation(chunk);
+        ENDSTAGE(GENSTAGE_ORES);
+        generateVegetation(chunk, columns);
+        ENDSTAGE(GENSTAGE_VEGETATION);
         generateSkyIslands(chunk);
-        generateKithgardFeatures(chunk);
+        ENDSTAGE(GENSTAGE_SKYISLANDS);
+        generateKithgardFeatures(chunk, columns);
+        chunk->compact();
+        ENDSTAGE(GENSTAGE_KITHGARD);
+        chunk->computeLight();
+        ENDSTAGE(GENSTAGE_LIGHT);
+        #undef ENDSTAGE
         chunk->markGenerated();
+
+        SDL_LockMutex(statsMutex);
+        loopi(LAYER_COUNT)
+        {
+            const WorldLayerData &layer = WorldLayerManager::getLayerData(WorldLayer(i));
+            int volume = (min(layer.maxY, CHUNK_HEIGHT - 1) - layer.minY + 1) * CHUNK_SIZE * CHUNK_SIZE;
+            stats.evaluated[i] += evaluated[i];
+            stats.bulkFilled[i] += volume - evaluated[i];
+        }
+        loopi(GENSTAGE_MESH) stats.stageTime[i] += stageTime[i];
+        stats.chunks++;
+        SDL_UnlockMutex(statsMutex);
     }
 
     void WorldGenerator::generateOres(Chunk *chunk)
     {
         ChunkCoord coord = chunk->getCoord();
-        int chunkWorldX = coord.x * CHUNK_SIZE;
-        int chunkWorldZ = coord.z * CHUNK_SIZE;
-
-        srand(seed ^ ((chunkWorldX << 16) ^ chunkWorldZ));
+        ChunkRandom rng(seed ^ (uint(coord.x) * 0x8DA6B343u) ^ (uint(coord.z) * 0xD8163841u));
 
         for(int i = 0; i < 24; ++i)
         {
-            int x = rand() % CHUNK_SIZE;
-            int y = rand() % WORLD_SURFACE_MAX;
-            int z = rand() % CHUNK_SIZE;
+            int x = rng.next(CHUNK_SIZE);
+            int y = rng.next(WORLD_SURFACE_MAX);
+            int z = rng.next(CHUNK_SIZE);
             if(!Chunk::isValidCoord(x, y, z)) continue;
             Block block = chunk->getBlock(x, y, z);
             if(block.type == BLOCK_STONE)
             {
-                int oreType = rand() % 100;
+                int oreType = rng.next(100);
                 if(oreType < 50) chunk->setBlock(x, y, z, BLOCK_COAL_ORE);
                 else if(oreType < 80) chunk->setBlock(x, y, z, BLOCK_IRON_ORE);
                 else if(oreType < 92) chunk->setBlock(x, y, z, BLOCK_GOLD_ORE);
@@ -286,7 +723,7 @@ namespace game
             }
             else if(block.type == BLOCK_KITHGARD_STONE)
             {
-                int rare = rand() % 100;
+                int rare = rng.next(100);
                 if(rare < 20) chunk->setBlock(x, y, z, BLOCK_KITHGARD_METAL);
                 else if(rare < 40) chunk->setBlock(x, y, z, BLOCK_KITHGARD_CRYSTAL);
                 else if(rare < 55) chunk->setBlock(x, y, z, BLOCK_KITHGARD_GLOWSTONE);
@@ -294,153 +731,664 @@ namespace game
         }
     }
 
-    void WorldGenerator::generateChunkMesh(Chunk *chunk)
+    struct BlockFace
     {
-        if(!chunk->isGenerated()) return;
+        int axis, dir, axisA, axisB;
+    };
 
-        ChunkMesh &mesh = chunk->getMesh();
-        mesh.clear();
+    // Quads are emitted as origin, +A, +A+B, +B, which keeps the winding of the
+    // original per-block faces for every orientation.
+    static const BlockFace blockFaces[FACE_COUNT] =
+    {
+        { 1,  1, 0, 2 }, // top
+        { 1, -1, 2, 0 }, // bottom
+        { 0, -1, 1, 2 }, // left
+        { 0,  1, 2, 1 }, // right
+        { 2,  1, 1, 0 }, // front
+        { 2, -1, 0, 1 }  // back
+    };
+
+    static const int MESH_PAD = CHUNK_SIZE + 2;
+    static const int MESH_PAD_VOLUME = MESH_PAD * MESH_PAD * MESH_PAD;
+
+    static inline int meshIndex(int x, int y, int z)
+    {
+        return ((y + 1) * MESH_PAD + (z + 1)) * MESH_PAD + (x + 1);
+    }
 
-        for(int x = 0; x < CHUNK_SIZE; ++x)
+    static inline ushort blockKey(const Block &block)
+    {
+        return ushort(block.type | (block.data << 8));
+    }
+
+    static inline bool isDrawnKey(ushort key)
+    {
+        return key != BLOCK_AIR && (key & 0xFF) != BLOCK_WATER;
+    }
+
+    static const int meshFaceOffsets[FACE_COUNT] =
+    {
+        MESH_PAD * MESH_PAD, -MESH_PAD * MESH_PAD, -1, 1, MESH_PAD, -MESH_PAD
+    };
+
+    static void addFaceQuad(MeshBuffer &mesh, int face, int type, int light, const ivec &origin, int sizeA, int sizeB)
+    {
+        const BlockFace &bf = blockFaces[face];
+        ivec da(0, 0, 0), db(0, 0, 0);
+        da[bf.axisA] = sizeA;
+        db[bf.axisB] = sizeB;
+
+        uint baseIdx = mesh.vertices.length();
+        ivec p(origin);
+        mesh.vertices.add(VoxelVertex(p.x, p.y, p.z, face, type, light));
+        p.add(da);
+        mesh.vertices.add(VoxelVertex(p.x, p.y, p.z, face, type, light));
+        p.add(db);
+        mesh.vertices.add(VoxelVertex(p.x, p.y, p.z, face, type, light));
+        p.sub(da);
+        mesh.vertices.add(VoxelVertex(p.x, p.y, p.z, face, type, light));
+        mesh.indices.add(baseIdx);
+        mesh.indices.add(baseIdx + 1);
+        mesh.indices.add(baseIdx + 2);
+        mesh.indices.add(baseIdx);
+        mesh.indices.add(baseIdx + 2);
+        mesh.indices.add(baseIdx + 3);
+    }
+
+    static const int sideFaces[CHUNK_SIDES] = { FACE_LEFT, FACE_RIGHT, FACE_BACK, FACE_FRONT };
+
+    static inline int borderSlice(const BlockFace &bf, int lod = 0)
+    {
+        return bf.dir > 0 ? (CHUNK_SIZE >> lod) - 1 : 0;
+    }
+
+    // Faces on the outer x/z slices look into the neighbouring chunk and are
+    // meshed separately into the chunk's border buffers.
+    static inline bool isBorderSlice(const BlockFace &bf, int slice, int lod)
+    {
+        return bf.axis != 1 && slice == borderSlice(bf, lod);
+    }
+
+    // Copies a section plus a one-voxel border into padded key and light
+    // buffers, so the meshers never have to bounds-check or go back through the
+    // chunk. Anything outside the chunk reads as unlit air; only border slices
+    // ever look at it.
+    static void gatherMeshSection(Chunk *chunk, int sectionY, ushort *vox, uchar *light)
+    {
+        int baseY = sectionY * CHUNK_SIZE;
+        for(int y = -1; y <= CHUNK_SIZE; ++y)
         {
-            for(int z = 0; z < CHUNK_SIZE; ++z)
+            for(int z = -1; z <= CHUNK_SIZE; ++z)
             {
-                for(int y = 0; y < CHUNK_HEIGHT; ++y)
+                for(int x = -1; x <= CHUNK_SIZE; ++x)
                 {
-                    Block block = chunk->getBlock(x, y, z);
-                    if(block.type == BLOCK_AIR || block.type == BLOCK_WATER) continue;
-
-                    bool drawTop = (y == CHUNK_HEIGHT - 1) || 
-                                   (chunk->getBlock(x, y + 1, z).type == BLOCK_AIR);
-                    bool drawBottom = (y == 0) || 
-                                      (chunk->getBlock(x, y - 1, z).type == BLOCK_AIR);
-                    bool drawLeft = (x == 0) || 
-                                    (chunk->getBlock(x - 1, y, z).type == BLOCK_AIR);
-                    bool drawRight = (x == CHUNK_SIZE - 1) || 
-                                     (chunk->getBlock(x + 1, y, z).type == BLOCK_AIR);
-                    bool drawFront = (z == CHUNK_SIZE - 1) || 
-                                     (chunk->getBlock(x, y, z + 1).type == BLOCK_AIR);
-                    bool drawBack = (z == 0) || 
-                                    (chunk->getBlock(x, y, z - 1).type == BLOCK_AIR);
-
-                    if(!drawTop && !drawBottom && !drawLeft && !drawRight && !drawFront && !drawBack)
-                        continue;
-
-                    float fx = (float)x;
-                    float fy = (float)y;
-                    float fz = (float)z;
-
-                    unsigned int baseIdx = mesh.vertices.length();
-
-                    if(drawTop)
-                    {
-                        mesh.vertices.add(vec(fx, fy + 1, fz));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz + 1));
-                        mesh.vertices.add(vec(fx, fy + 1, fz + 1));
-                        vec normal(0, 1, 0);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
-                    }
+                    int idx = meshIndex(x, y, z);
+                    vox[idx] = blockKey(chunk->getBlock(x, baseY + y, z));
+                    light[idx] = chunk->getLight(x, baseY + y, z);
+                }
+            }
+        }
+    }
 
-                    if(drawBottom)
-                    {
-                        mesh.vertices.add(vec(fx, fy, fz));
-                        mesh.vertices.add(vec(fx, fy, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy, fz));
-                        vec normal(0, -1, 0);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
-                    }
+    // At LOD level n the meshers work on cells of 2^n blocks a side. A cell
+    // takes the block of its highest drawn voxel when at least half of it is
+    // drawn, otherwise reads as water when at least half of it is filled at all,
+    // and as air past that; its light is the brightest of each channel inside.
+    // Cells never straddle sections. cy counts cells from the bottom of the
+    // chunk, and cells outside the chunk read as air.
+    static ushort sampleLodCell(const Chunk *chunk, int cx, int cy, int cz, int lod, uchar &light)
+    {
+        int scale = 1 << lod, x0 = cx << lod, y0 = cy << lod, z0 = cz << lod;
+        if(!Chunk::isValidCoord(x0, y0, z0))
+        {
+            light = chunk->getLight(x0, y0, z0);
+            return BLOCK_AIR;
+        }
+        int sectionY = y0 >> 4;
+        const ChunkSection *section = chunk->getSection(sectionY);
+        ushort top = BLOCK_AIR;
+        int drawn = 0, filled = 0;
+        if(section->isUniform())
+        {
+            top = blockKey(section->getBlock(0));
+            if(top != BLOCK_AIR) filled = scale * scale * scale;
+            if(isDrawnKey(top)) drawn = filled;
+        }
+        else for(int y = y0 + scale - 1; y >= y0; --y) for(int z = z0; z < z0 + scale; ++z) for(int x = x0; x < x0 + scale; ++x)
+        {
+            ushort key = blockKey(section->getBlock(ChunkSection::toIndex(x, y & 15, z)));
+            if(key == BLOCK_AIR) continue;
+            filled++;
+            if(!isDrawnKey(key)) continue;
+            if(!drawn++) top = key;
+        }
 
-                    if(drawLeft)
-                    {
-                        mesh.vertices.add(vec(fx, fy, fz));
-                        mesh.vertices.add(vec(fx, fy + 1, fz));
-                        mesh.vertices.add(vec(fx, fy + 1, fz + 1));
-                        mesh.vertices.add(vec(fx, fy, fz + 1));
-                        vec normal(-1, 0, 0);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
-                    }
+        if(chunk->hasUniformLight(sectionY)) light = chunk->getUniformLight(sectionY);
+        else
+        {
+            int sky = 0, block = 0;
+            for(int y = y0; y < y0 + scale; ++y) for(int z = z0; z < z0 + scale; ++z) for(int x = x0; x < x0 + scale; ++x)
+            {
+                int l = chunk->getLight(x, y, z);
+                sky = max(sky, l & 0xF0);
+                block = max(block, l & 15);
+            }
+            light = uchar(sky | block);
+        }
 
-                    if(drawRight)
-                    {
-                        mesh.vertices.add(vec(fx + 1, fy, fz));
-                        mesh.vertices.add(vec(fx + 1, fy, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz));
-                        vec normal(1, 0, 0);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
-                    }
+        int volume = scale * scale * scale;
+        if(drawn * 2 >= volume) return top;
+        return filled * 2 >= volume ? ushort(BLOCK_WATER) : ushort(BLOCK_AIR);
+    }
 
-                    if(drawFront)
+    // Same as gatherMeshSection, one cell per entry.
+    static void gatherLodSection(Chunk *chunk, int sectionY, int lod, ushort *vox, uchar *light)
+    {
+        int size = CHUNK_SIZE >> lod, baseY = sectionY * size;
+        for(int y = -1; y <= size; ++y)
+        {
+            for(int z = -1; z <= size; ++z)
+            {
+                for(int x = -1; x <= size; ++x)
+                {
+                    int idx = meshIndex(x, y, z);
+                    if(x < 0 || x >= size || z < 0 || z >= size)
                     {
-                        mesh.vertices.add(vec(fx, fy, fz + 1));
-                        mesh.vertices.add(vec(fx, fy + 1, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz + 1));
-                        mesh.vertices.add(vec(fx + 1, fy, fz + 1));
-                        vec normal(0, 0, 1);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
+                        vox[idx] = BLOCK_AIR;
+                        light[idx] = 0;
                     }
+                    else vox[idx] = sampleLodCell(chunk, x, baseY + y, z, lod, light[idx]);
+                }
+            }
+        }
+    }
+
+    static void gatherSection(Chunk *chunk, int sectionY, int lod, ushort *vox, uchar *light)
+    {
+        if(lod) gatherLodSection(chunk, sectionY, lod, vox, light);
+        else gatherMeshSection(chunk, sectionY, vox, light);
+    }
+
+    // Fills just the outer slice of a section facing the given side, and the
+    // matching slice of the neighbour across the seam (open sky if not loaded).
+    static void gatherBorderSection(Chunk *chunk, Chunk *neighbour, int side, int sectionY, ushort *vox, uchar *light)
+    {
+        const BlockFace &bf = blockFaces[sideFaces[side]];
+        int baseY = sectionY * CHUNK_SIZE;
+        for(int b = 0; b < CHUNK_SIZE; ++b)
+        {
+            for(int a = 0; a < CHUNK_SIZE; ++a)
+            {
+                ivec pos;
+                pos[bf.axis] = borderSlice(bf);
+                pos[bf.axisA] = a;
+                pos[bf.axisB] = b;
+                vox[meshIndex(pos.x, pos.y, pos.z)] = blockKey(chunk->getBlock(pos.x, baseY + pos.y, pos.z));
+
+                ivec across(pos);
+                across[bf.axis] += bf.dir;
+                ivec local(across);
+                local[bf.axis] -= bf.dir * CHUNK_SIZE;
+                int idx = meshIndex(across.x, across.y, across.z);
+                vox[idx] = neighbour ? blockKey(neighbour->getBlock(local.x, baseY + local.y, local.z)) : ushort(BLOCK_AIR);
+                light[idx] = neighbour ? neighbour->getLight(local.x, baseY + local.y, local.z) : SKYLIGHT;
+            }
+        }
+    }
+
+    // When either side of a seam is meshed at a coarser level, each cell on
+    // this side is tested against the cells the neighbour actually draws: the
+    // face is culled only if every neighbour cell covering it is filled. Both
+    // sides doing this leaves no gap along the seam whatever the two levels.
+    static void gatherLodBorderSection(Chunk *chunk, Chunk *neighbour, int side, int sectionY, ushort *vox, uchar *light)
+    {
+        const BlockFace &bf = blockFaces[sideFaces[side]];
+        int lod = chunk->getLod(), size = CHUNK_SIZE >> lod;
+        int acrossLod = neighbour ? neighbour->getLod() : 0, acrossSize = CHUNK_SIZE >> acrossLod;
+        int span = 1 << max(lod - acrossLod, 0);
+        for(int b = 0; b < size; ++b)
+        {
+            for(int a = 0; a < size; ++a)
+            {
+                ivec pos;
+                pos[bf.axis] = borderSlice(bf, lod);
+                pos[bf.axisA] = a;
+                pos[bf.axisB] = b;
+                int inside = meshIndex(pos.x, pos.y, pos.z);
+                vox[inside] = sampleLodCell(chunk, pos.x, sectionY * size + pos.y, pos.z, lod, light[inside]);
+
+                ivec across(pos);
+                across[bf.axis] += bf.dir;
+                int idx = meshIndex(across.x, across.y, across.z);
+                if(!neighbour)
+                {
+                    vox[idx] = BLOCK_AIR;
+                    light[idx] = SKYLIGHT;
+                    continue;
+                }
+
+                // Cells of this chunk's level and the neighbour's, counted
+                // along the seam from the bottom of the chunk.
+                ivec first(pos);
+                first.y += sectionY * size;
+                first[bf.axis] = bf.dir > 0 ? 0 : acrossSize - 1;
+                loopk(3) if(k != bf.axis) first[k] = (first[k] << lod) >> acrossLod;
+                int sky = 0, block = 0;
+                bool covered = true;
+                loopj(span) loopk(span)
+                {
+                    ivec cell(first);
+                    cell[bf.axisA] += k;
+                    cell[bf.axisB] += j;
+                    uchar cellLight;
+                    if(sampleLodCell(neighbour, cell.x, cell.y, cell.z, acrossLod, cellLight) != BLOCK_AIR) continue;
+                    covered = false;
+                    sky = max(sky, cellLight & 0xF0);
+                    block = max(block, cellLight & 15);
+                }
+                vox[idx] = covered ? ushort(BLOCK_WATER) : ushort(BLOCK_AIR);
+                light[idx] = uchar(sky | block);
+            }
+        }
+    }
 
-                    if(drawBack)
+    // Emits the visible faces of one slice of a section's cells, each lit by
+    // the cell it faces. With greedy meshing, faces of identical blocks under
+    // the same light are merged into maximal rectangles.
+    static void meshSlice(const ushort *vox, const uchar *light, int baseY, int f, int s, int lod, MeshBuffer &mesh)
+    {
+        const BlockFace &bf = blockFaces[f];
+        int offset = meshFaceOffsets[f], size = CHUNK_SIZE >> lod;
+        uint mask[CHUNK_SIZE * CHUNK_SIZE];
+        bool any = false;
+        for(int b = 0; b < size; ++b)
+        {
+            for(int a = 0; a < size; ++a)
+            {
+                ivec pos;
+                pos[bf.axis] = s;
+                pos[bf.axisA] = a;
+                pos[bf.axisB] = b;
+                int idx = meshIndex(pos.x, pos.y, pos.z);
+                ushort key = vox[idx];
+                bool visible = isDrawnKey(key) && vox[idx + offset] == BLOCK_AIR;
+                mask[b * CHUNK_SIZE + a] = visible ? key | (light[idx + offset] << 16) : 0;
+                any |= visible;
+            }
+        }
+        if(!any) return;
+
+        for(int b = 0; b < size; ++b)
+        {
+            for(int a = 0; a < size;)
+            {
+                uint key = mask[b * CHUNK_SIZE + a];
+                if(!key) { ++a; continue; }
+
+                int w = 1, h = 1;
+                if(greedymesh)
+                {
+                    while(a + w < size && mask[b * CHUNK_SIZE + a + w] == key) ++w;
+                    for(; b + h < size; ++h)
                     {
-                        mesh.vertices.add(vec(fx, fy, fz));
-                        mesh.vertices.add(vec(fx + 1, fy, fz));
-                        mesh.vertices.add(vec(fx + 1, fy + 1, fz));
-                        mesh.vertices.add(vec(fx, fy + 1, fz));
-                        vec normal(0, 0, -1);
-                        for(int i = 0; i < 4; ++i) mesh.normals.add(normal);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 1);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx);
-                        mesh.indices.add(baseIdx + 2);
-                        mesh.indices.add(baseIdx + 3);
-                        baseIdx += 4;
+                        const uint *row = &mask[(b + h) * CHUNK_SIZE + a];
+                        int k = 0;
+                        while(k < w && row[k] == key) ++k;
+                        if(k < w) break;
                     }
+                    for(int j = 0; j < h; ++j) memset(&mask[(b + j) * CHUNK_SIZE + a], 0, w * sizeof(uint));
+                }
+
+                ivec origin;
+                origin[bf.axis] = s + (bf.dir > 0 ? 1 : 0);
+                origin[bf.axisA] = a;
+                origin[bf.axisB] = b;
+                origin.shl(lod);
+                origin.y += baseY;
+                addFaceQuad(mesh, f, key & 0xFF, key >> 16, origin, w << lod, h << lod);
+                a += w;
+            }
+        }
+    }
+
+    static void meshSectionInterior(const ushort *vox, const uchar *light, int baseY, int lod, MeshBuffer &mesh)
+    {
+        for(int f = 0; f < FACE_COUNT; ++f)
+        {
+            const BlockFace &bf = blockFaces[f];
+            for(int s = 0; s < CHUNK_SIZE >> lod; ++s)
+            {
+                if(!isBorderSlice(bf, s, lod)) meshSlice(vox, light, baseY, f, s, lod, mesh);
+            }
+        }
+    }
+
+    static void meshChunkBorder(Chunk *chunk, Chunk *neighbour, int side, MeshBuffer &mesh)
+    {
+        mesh.clear();
+        int face = sideFaces[side], lod = chunk->getLod();
+        int slice = borderSlice(blockFaces[face], lod);
+        bool coarse = lod || (neighbour && neighbour->getLod());
+        ushort vox[MESH_PAD_VOLUME];
+        uchar light[MESH_PAD_VOLUME];
+        for(int sy = 0; sy < CHUNK_SECTIONS; ++sy)
+        {
+            if(chunk->getSection(sy)->isEmpty()) continue;
+            if(coarse) gatherLodBorderSection(chunk, neighbour, side, sy, vox, light);
+            else gatherBorderSection(chunk, neighbour, side, sy, vox, light);
+            meshSlice(vox, light, sy * CHUNK_SIZE, face, slice, lod, mesh);
+        }
+    }
+
+    // Smooth terrain runs marching cubes over a density field taken from the
+    // blocks themselves, so edits show up without going back to the noise:
+    // every lattice corner sits where eight blocks meet and holds the fraction
+    // of them that are drawn. With the surface at half density, flat ground
+    // stays on the block tops. Vertices are shared between the cells around
+    // each lattice edge, and normals follow the density gradient.
+    static const float SMOOTH_ISOLEVEL = 0.5f;
+    static const int SMOOTH_PAD = CHUNK_SIZE + 4;
+    static const int SMOOTH_CORNERS = CHUNK_SIZE + 3;
+    static const int SMOOTH_EDGES = (CHUNK_SIZE + 1) * (CHUNK_SIZE + 1) * (CHUNK_SIZE + 1) * 4;
+
+    // Which neighbour holds a block outside the chunk, by [dz + 1][dx + 1].
+    static const int smoothNeighbours[3][3] =
+    {
+        { CHUNK_CORNER_XNEG_ZNEG, CHUNK_SIDE_ZNEG, CHUNK_CORNER_XPOS_ZNEG },
+        { CHUNK_SIDE_XNEG, -1, CHUNK_SIDE_XPOS },
+        { CHUNK_CORNER_XNEG_ZPOS, CHUNK_SIDE_ZPOS, CHUNK_CORNER_XPOS_ZPOS }
+    };
+
+    struct SmoothMesher
+    {
+        Chunk *chunk;
+        Chunk *const *neighbours;
+        int baseY, mark;
+        uchar drawn[SMOOTH_PAD * SMOOTH_PAD * SMOOTH_PAD], types[SMOOTH_PAD * SMOOTH_PAD * SMOOTH_PAD], light[SMOOTH_PAD * SMOOTH_PAD * SMOOTH_PAD];
+        float density[SMOOTH_CORNERS * SMOOTH_CORNERS * SMOOTH_CORNERS];
+        uchar inside[SMOOTH_CORNERS * SMOOTH_CORNERS * SMOOTH_CORNERS];
+        int edgeVertex[SMOOTH_EDGES], edgeMark[SMOOTH_EDGES];
+
+        SmoothMesher(Chunk *chunk, Chunk *const *neighbours) : chunk(chunk), neighbours(neighbours), baseY(0), mark(0)
+        {
+            memset(edgeMark, 0, sizeof(edgeMark));
+        }
+
+        // Voxels are gathered from -2 to CHUNK_SIZE + 1 and corners from -1 to
+        // CHUNK_SIZE + 1, which is what the gradients at the cell corners need.
+        static int voxelIndex(int x, int y, int z) { return ((y + 2) * SMOOTH_PAD + (z + 2)) * SMOOTH_PAD + (x + 2); }
+        static int cornerIndex(int x, int y, int z) { return ((y + 1) * SMOOTH_CORNERS + (z + 1)) * SMOOTH_CORNERS + (x + 1); }
+        static int edgeIndex(int x, int y, int z, int axis) { return (((y * (CHUNK_SIZE + 1)) + z) * (CHUNK_SIZE + 1) + x) * 4 + axis; }
+
+        const Chunk *getSource(int &x, int &z) const
+        {
+            int dx = x < 0 ? -1 : (x >= CHUNK_SIZE ? 1 : 0), dz = z < 0 ? -1 : (z >= CHUNK_SIZE ? 1 : 0);
+            if(!dx && !dz) return chunk;
+            x -= dx * CHUNK_SIZE;
+            z -= dz * CHUNK_SIZE;
+            return neighbours ? neighbours[smoothNeighbours[dz + 1][dx + 1]] : NULL;
+        }
+
+        // 0 if nothing in the section is drawn, 1 if all of it is, -1 otherwise.
+        static int getSectionFill(const Chunk *chunk, int sy)
+        {
+            if(!chunk || sy < 0 || sy >= CHUNK_SECTIONS) return 0;
+            const ChunkSection *section = chunk->getSection(sy);
+            if(section->isEmpty()) return 0;
+            if(!section->isUniform()) return -1;
+            return isDrawnKey(blockKey(section->getBlock(0))) ? 1 : 0;
+        }
+
+        // A section's cells only see the sections around it, so there is
+        // nothing to mesh when all of those are empty, or all full.
+        bool isSkippable(int sy) const
+        {
+            int fill = getSectionFill(chunk, sy);
+            if(fill < 0) return false;
+            for(int dy = -1; dy <= 1; ++dy)
+            {
+                if(getSectionFill(chunk, sy + dy) != fill) return false;
+                loopi(CHUNK_NEIGHBOURS) if(getSectionFill(neighbours ? neighbours[i] : NULL, sy + dy) != fill) return false;
+            }
+            return true;
+        }
+
+        void gather(int sy)
+        {
+            baseY = sy * CHUNK_SIZE;
+            for(int z = -2; z < CHUNK_SIZE + 2; ++z) for(int x = -2; x < CHUNK_SIZE + 2; ++x)
+            {
+                int localX = x, localZ = z;
+                const Chunk *src = getSource(localX, localZ);
+                for(int y = -2; y < CHUNK_SIZE + 2; ++y)
+                {
+                    int idx = voxelIndex(x, y, z);
+                    Block block = src ? src->getBlock(localX, baseY + y, localZ) : Block(BLOCK_AIR);
+                    drawn[idx] = isDrawnKey(blockKey(block)) ? 1 : 0;
+                    types[idx] = block.type;
+                    light[idx] = src ? src->getLight(localX, baseY + y, localZ) : SKYLIGHT;
                 }
             }
+            for(int y = -1; y <= CHUNK_SIZE + 1; ++y) for(int z = -1; z <= CHUNK_SIZE + 1; ++z) for(int x = -1; x <= CHUNK_SIZE + 1; ++x)
+            {
+                int count = 0;
+                loopi(8) count += drawn[voxelIndex(x - 1 + (i & 1), y - 1 + (i >> 2), z - 1 + ((i >> 1) & 1))];
+                int idx = cornerIndex(x, y, z);
+                density[idx] = count / 8.0f;
+                inside[idx] = density[idx] >= SMOOTH_ISOLEVEL ? 1 : 0;
+            }
+        }
+
+        vec getGradient(int x, int y, int z) const
+        {
+            return vec(density[cornerIndex(x + 1, y, z)] - density[cornerIndex(x - 1, y, z)],
+                       density[cornerIndex(x, y + 1, z)] - density[cornerIndex(x, y - 1, z)],
+                       density[cornerIndex(x, y, z + 1)] - density[cornerIndex(x, y, z - 1)]);
+        }
+
+        // The vertex on the lattice edge from corner (x, y, z) along axis takes
+        // the topmost drawn block around its inside corner and the brightest
+        // light around its outside corner. A vertex landing right on a corner
+        // is keyed by the corner instead, so every edge through it shares it
+        // and the triangles that collapse there can be dropped.
+        int addVertex(MeshBuffer &mesh, int x, int y, int z, int axis)
+        {
+            ivec a(x, y, z), b(x, y, z);
+            b[axis]++;
+            float da = density[cornerIndex(a.x, a.y, a.z)], db = density[cornerIndex(b.x, b.y, b.z)];
+            float mu = (SMOOTH_ISOLEVEL - da) / (db - da);
+            if(mu <= 0 || mu >= 1)
+            {
+                if(mu >= 1) a = b;
+                b = a;
+                da = db = SMOOTH_ISOLEVEL;
+                mu = 0;
+                axis = 3;
+            }
+
+            int edge = edgeIndex(a.x, a.y, a.z, axis);
+            if(edgeMark[edge] == mark) return edgeVertex[edge];
+
+            vec pos = vec(a).lerp(vec(b), mu);
+            pos.y += baseY;
+            vec normal = getGradient(a.x, a.y, a.z).lerp(getGradient(b.x, b.y, b.z), mu).neg();
+            if(normal.iszero()) normal = vec(0, 1, 0);
+            else normal.normalize();
+
+            const ivec &in = da >= SMOOTH_ISOLEVEL ? a : b, &out = db >= SMOOTH_ISOLEVEL ? a : b;
+            int type = BLOCK_STONE, sky = 0, blocklight = 0;
+            for(int i = 7; i >= 0; --i)
+            {
+                int idx = voxelIndex(in.x - 1 + (i & 1), in.y - 1 + (i >> 2), in.z - 1 + ((i >> 1) & 1));
+                if(drawn[idx]) { type = types[idx]; break; }
+            }
+            loopi(8)
+            {
+                int l = light[voxelIndex(out.x - 1 + (i & 1), out.y - 1 + (i >> 2), out.z - 1 + ((i >> 1) & 1))];
+                sky = max(sky, getLightChannel(l, LIGHT_SKY));
+                blocklight = max(blocklight, getLightChannel(l, LIGHT_BLOCK));
+            }
+
+            int index = mesh.vertices.length();
+            mesh.vertices.add(VoxelVertex::smooth(pos, normal, type, blocklight | (sky << 4)));
+            edgeMark[edge] = mark;
+            edgeVertex[edge] = index;
+            return index;
+        }
+
+        void meshSection(int sy, MeshBuffer &mesh)
+        {
+            if(isSkippable(sy)) return;
+            gather(sy);
+            mark++;
+            int cornerSteps[8];
+            loopi(8) cornerSteps[i] = cornerIndex(MarchingCubes::cornerOffsets[i][0], MarchingCubes::cornerOffsets[i][1], MarchingCubes::cornerOffsets[i][2]) - cornerIndex(0, 0, 0);
+            for(int y = 0; y < CHUNK_SIZE; ++y) for(int z = 0; z < CHUNK_SIZE; ++z) for(int x = 0; x < CHUNK_SIZE; ++x)
+            {
+                const uchar *corners = &inside[cornerIndex(x, y, z)];
+                int cubeIndex = 0;
+                loopi(8) if(!corners[cornerSteps[i]]) cubeIndex |= 1 << i;
+                int edgeMask = MarchingCubes::getEdgeMask(cubeIndex);
+                if(!edgeMask) continue;
+
+                int verts[12];
+                loopi(12) if(edgeMask & (1 << i))
+                {
+                    const int *c0 = MarchingCubes::cornerOffsets[MarchingCubes::edgeCorners[i][0]], *c1 = MarchingCubes::cornerOffsets[MarchingCubes::edgeCorners[i][1]];
+                    int axis = c0[0] != c1[0] ? 0 : (c0[1] != c1[1] ? 1 : 2);
+                    verts[i] = addVertex(mesh, x + min(c0[0], c1[0]), y + min(c0[1], c1[1]), z + min(c0[2], c1[2]), axis);
+                }
+                const int *tris = MarchingCubes::getTriangles(cubeIndex);
+                for(int i = 0; tris[i] >= 0; i += 3)
+                {
+                    int v0 = verts[tris[i]], v1 = verts[tris[i + 1]], v2 = verts[tris[i + 2]];
+                    if(v0 == v1 || v1 == v2 || v2 == v0) continue;
+                    mesh.indices.add(v0);
+                    mesh.indices.add(v2);
+                    mesh.indices.add(v1);
+                }
+            }
+        }
+    };
+
+    // Every section is meshed whole, edge cells included, since those read
+    // the neighbours; when a neighbour comes or goes the chunk is flagged on
+    // a side and all of it is rebuilt.
+    static void generateSmoothMesh(Chunk *chunk, Chunk *const *neighbours, ChunkMesh &mesh)
+    {
+        SmoothMesher *mesher = new SmoothMesher(chunk, neighbours);
+        MeshBuffer piece;
+        for(int sy = 0; sy < CHUNK_SECTIONS; ++sy)
+        {
+            mesh.sectionVertices[sy] = mesh.vertices.length();
+            mesh.sectionIndices[sy] = mesh.indices.length();
+            piece.clear();
+            mesher->meshSection(sy, piece);
+            uint base = mesh.vertices.length();
+            mesh.vertices.put(piece.vertices.getbuf(), piece.vertices.length());
+            loopv(piece.indices) mesh.indices.add(base + piece.indices[i]);
+        }
+        mesh.sectionVertices[CHUNK_SECTIONS] = mesh.vertices.length();
+        mesh.sectionIndices[CHUNK_SECTIONS] = mesh.indices.length();
+        delete mesher;
+    }
+
+    // Smooth meshes keep no separate sides, so flagged sides mean nothing to
+    // them; a neighbour arriving asks for a full rebuild instead.
+    static void updateSmoothMesh(Chunk *chunk, Chunk *const *neighbours, ChunkMesh &mesh)
+    {
+        mesh.dirtyBorders = 0;
+        if(mesh.rebuildAll)
+        {
+            mesh.clear();
+            generateSmoothMesh(chunk, neighbours, mesh);
+            return;
+        }
+        SmoothMesher *mesher = new SmoothMesher(chunk, neighbours);
+        MeshBuffer piece;
+        for(int sy = 0; sy < CHUNK_SECTIONS; ++sy) if(mesh.isSectionDirty(sy))
+        {
+            piece.clear();
+            mesher->meshSection(sy, piece);
+            mesh.replaceSection(sy, piece);
+        }
+        delete mesher;
+    }
+
+    void WorldGenerator::generateChunkMesh(Chunk *chunk, Chunk *const *neighbours)
+    {
+        if(!chunk->isGenerated()) return;
+
+        llong meshStart = getStageClock();
+        ChunkMesh &mesh = chunk->getMesh();
+        mesh.clear();
+
+        if(smoothterrain) generateSmoothMesh(chunk, neighbours, mesh);
+        else
+        {
+            ushort vox[MESH_PAD_VOLUME];
+            uchar light[MESH_PAD_VOLUME];
+            for(int sy = 0; sy < CHUNK_SECTIONS; ++sy)
+            {
+                mesh.sectionVertices[sy] = mesh.vertices.length();
+                mesh.sectionIndices[sy] = mesh.indices.length();
+                if(chunk->getSection(sy)->isEmpty()) continue;
+                gatherSection(chunk, sy, chunk->getLod(), vox, light);
+                meshSectionInterior(vox, light, sy * CHUNK_SIZE, chunk->getLod(), mesh);
+            }
+            mesh.sectionVertices[CHUNK_SECTIONS] = mesh.vertices.length();
+            mesh.sectionIndices[CHUNK_SECTIONS] = mesh.indices.length();
+
+            loopi(CHUNK_SIDES) meshChunkBorder(chunk, neighbours ? neighbours[i] : NULL, i, mesh.borders[i]);
         }
+        mesh.assembleBorders();
 
         chunk->markMeshBuilt();
+
+        llong meshTime = getStageClock() - meshStart;
+        SDL_LockMutex(statsMutex);
+        stats.stageTime[GENSTAGE_MESH] += meshTime;
+        stats.meshes++;
+        SDL_UnlockMutex(statsMutex);
     }
 
-    void WorldGenerator::generateVegetation(Chunk *chunk)
+    // Rebuilds only the sections and chunk sides flagged since the last build.
+    void WorldGenerator::generateDirtyMesh(Chunk *chunk, Chunk *const *neighbours)
+    {
+        ChunkMesh &mesh = chunk->getMesh();
+        if(!chunk->isMeshBuilt()) return;
+
+        if(smoothterrain) updateSmoothMesh(chunk, neighbours, mesh);
+        else if(mesh.rebuildAll) generateChunkMesh(chunk, neighbours);
+        else
+        {
+            if(mesh.hasDirtySections())
+            {
+                MeshBuffer piece;
+                ushort vox[MESH_PAD_VOLUME];
+                uchar light[MESH_PAD_VOLUME];
+                for(int sy = 0; sy < CHUNK_SECTIONS; ++sy) if(mesh.isSectionDirty(sy))
+                {
+                    piece.clear();
+                    if(!chunk->getSection(sy)->isEmpty())
+                    {
+                        gatherSection(chunk, sy, chunk->getLod(), vox, light);
+                        meshSectionInterior(vox, light, sy * CHUNK_SIZE, chunk->getLod(), piece);
+                    }
+                    mesh.replaceSection(sy, piece);
+                }
+            }
+
+            loopi(CHUNK_SIDES) if(mesh.dirtyBorders & (1 << i))
+            {
+                meshChunkBorder(chunk, neighbours ? neighbours[i] : NULL, i, mesh.borders[i]);
+            }
+        }
+        mesh.dirtyBorders = 0;
+        mesh.assembleBorders();
+    }
+
+    void WorldGenerator::generateVegetation(Chunk *chunk, const ChunkColumns &columns)
     {
         ChunkCoord coord = chunk->getCoord();
         int baseX = coord.x * CHUNK_SIZE;
@@ -459,16 +1407,7 @@ namespace game
 
                 if(!vegList.empty())
                 {
-                    int topY = -1;
-                    for(int y = min(CHUNK_HEIGHT - 2, WORLD_SURFACE_MAX); y >= WORLD_CAVES_MAX; --y)
-                    {
-                        Block below = chunk->getBlock(x, y, z);
-                        if(below.type == BLOCK_AIR || below.type == BLOCK_WATER) continue;
-                        if(below.type == BLOCK_VEGETATION) continue;
-                        topY = y;
-                        break;
-                    }
-
+                    int topY = chunk->getHeight(x, z, HEIGHTMAP_SOLID, LAYER_SURFACE);
                     if(topY >= 0)
                     {
                         Block ground = chunk->getBlock(x, topY, z);
@@ -547,9 +1486,8 @@ namespace game
                         Block above = chunk->getBlock(x, targetY, z);
                         if(above.type == BLOCK_AIR)
                         {
-                            double humid = noiseGen->getHumidity(worldX, worldZ);
-                            double weird = noiseGen->getWeirdness(worldX, worldZ);
-                            KithgardBiomeType kBiome = WorldLayerManager::selectKithgardBiome(humid, weird, (double)kTop);
+                            const ColumnClimate &column = columns.get(x, z);
+                            KithgardBiomeType kBiome = WorldLayerManager::selectKithgardBiome(column.humidity, column.weirdness, (double)kTop);
 
                             const VegetationType *kVeg = NULL;
                             int kVegCount = 0;
@@ -631,20 +1569,11 @@ namespace game
                 int worldZ = baseZ + z;
                 unsigned int columnSeed = seed ^ (unsigned int)(worldX * 1103515245) ^ (unsigned int)(worldZ * 12345);
 
-                int topY = -1;
-                for(int y = CHUNK_HEIGHT - 2; y >= WORLD_SKIES_MIN; --y)
-                {
-                    Block block = chunk->getBlock(x, y, z);
-                    if(block.type == BLOCK_FLOATSTONE || block.type == BLOCK_SKY_DIRT || block.type == BLOCK_SKY_GRASS)
-                    {
-                        topY = y;
-                        break;
-                    }
-                }
-
+                int topY = chunk->getHeight(x, z, HEIGHTMAP_SOLID, LAYER_SKIES);
                 if(topY < 0) continue;
 
                 Block topBlock = chunk->getBlock(x, topY, z);
+                if(topBlock.type != BLOCK_FLOATSTONE && topBlock.type != BLOCK_SKY_DIRT && topBlock.type != BLOCK_SKY_GRASS) continue;
                 if(topBlock.type == BLOCK_FLOATSTONE)
                 {
                     chunk->setBlock(x, topY, z, BLOCK_SKY_GRASS);
@@ -684,7 +1613,7 @@ namespace game
         }
     }
 
-    void WorldGenerator::generateKithgardFeatures(Chunk *chunk)
+    void WorldGenerator::generateKithgardFeatures(Chunk *chunk, const ChunkColumns &columns)
     {
         ChunkCoord coord = chunk->getCoord();
         int baseX = coord.x * CHUNK_SIZE;
@@ -697,8 +1626,8 @@ namespace game
                 int worldX = baseX + x;
                 int worldZ = baseZ + z;
                 unsigned int columnSeed = seed ^ (unsigned int)(worldX * 2654435761u) ^ (unsigned int)(worldZ * 805459861u);
-                double humid = noiseGen->getHumidity(worldX, worldZ);
-                double weird = noiseGen->getWeirdness(worldX, worldZ);
+                double humid = columns.get(x, z).humidity;
+                double weird = columns.get(x, z).weirdness;
 
                 for(int y = WORLD_KITHGARD_MIN; y <= WORLD_KITHGARD_MAX; ++y)
                 {
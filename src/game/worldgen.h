@@ -7,33 +7,207 @@
 #include "marchingcubes.h"
 #include "worldlayer.h"
 #include "vegetation.h"
+#include "cavecarver.h"
 
 namespace game
 {
+    extern int greedymesh, smoothterrain, noiselattice, noiselatticexz, noiselatticey, wormcaves, climatelattice, biomeblend;
+
+    // Small self-contained generator so that generation passes stay deterministic
+    // per chunk regardless of which thread runs them or in what order.
+    struct ChunkRandom
+    {
+        uint state;
+
+        ChunkRandom(uint seed)
+        {
+            state = seed * 0x9E3779B9u + 0x7F4A7C15u;
+            state = (state ^ (state >> 16)) * 0x85EBCA6Bu;
+            state = (state ^ (state >> 13)) * 0xC2B2AE35u;
+            state ^= state >> 16;
+            if(!state) state = 0x6D2B79F5u;
+        }
+
+        uint next()
+        {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            return state;
+        }
+
+        int next(int n) { return int(next() % uint(n)); }
+        float nextFloat() { return (next() >> 8) * (1.0f / (1 << 24)); }
+    };
+
+    // Everything generation needs per (x, z) column, sampled once per chunk and
+    // shared by all passes. The sky* terms are the density climate at (x/2, z/2),
+    // where floating islands sample their 3D density. baseHeight and
+    // heightVariation are the biome's, or blended across biome borders.
+    struct ColumnClimate
+    {
+        double continentalness, erosion, peaks;
+        double temperature, humidity, weirdness;
+        double terrainHeight;
+        double skyContinentalness, skyErosion, skyPeaks;
+        double baseHeight, heightVariation;
+        BiomeType biome;
+    };
+
+    enum
+    {
+        CLIMATE_CONTINENTALNESS = 0,
+        CLIMATE_EROSION,
+        CLIMATE_PEAKS,
+        CLIMATE_TEMPERATURE,
+        CLIMATE_HUMIDITY,
+        CLIMATE_WEIRDNESS,
+        CLIMATE_SKY_CONTINENTALNESS,
+        CLIMATE_SKY_EROSION,
+        CLIMATE_SKY_PEAKS,
+        NUM_CLIMATE_FIELDS
+    };
+
+    static const int CLIMATE_STEP = 4;
+    static const int MAX_BIOME_BLEND = 2;
+
+    // The climate fields sampled every CLIMATE_STEP columns on a world-aligned
+    // grid, size points a side starting at grid point (originX, originZ), so
+    // neighbouring chunks share the points along their seams. The biome height
+    // terms of each point are box filtered over blend points in every direction;
+    // only points at least blend in from the edge hold filtered values. Columns
+    // not aligned to the grid need one more point a side.
+    struct ClimateLattice
+    {
+        enum { MAX_SIZE = CHUNK_SIZE / CLIMATE_STEP + 2 + 2 * MAX_BIOME_BLEND };
+
+        int originX, originZ, size;
+        float fields[NUM_CLIMATE_FIELDS][MAX_SIZE * MAX_SIZE];
+        double baseHeight[MAX_SIZE * MAX_SIZE], heightVariation[MAX_SIZE * MAX_SIZE];
+
+        void interpolateClimate(int worldX, int worldZ, ColumnClimate &column) const;
+        void interpolateHeights(int worldX, int worldZ, ColumnClimate &column) const;
+    };
+
+    struct ChunkColumns
+    {
+        ColumnClimate columns[CHUNK_SIZE * CHUNK_SIZE];
+
+        ColumnClimate &get(int x, int z) { return columns[z * CHUNK_SIZE + x]; }
+        const ColumnClimate &get(int x, int z) const { return columns[z * CHUNK_SIZE + x]; }
+    };
+
+    enum
+    {
+        FIELD_CAVE_SPAGHETTI = 0,
+        FIELD_CAVE_CHEESE,
+        FIELD_CAVE_NOISE,
+        FIELD_DENSITY,
+        FIELD_SKY_DENSITY,
+        NUM_NOISE_FIELDS
+    };
+
+    // One 3D noise field sampled every stepXZ x stepY x stepXZ voxels over a
+    // chunk and trilinearly interpolated in between. Lattice points sit on
+    // chunk-aligned positions, so neighbouring chunks agree along their seams.
+    struct NoiseLattice
+    {
+        int stepXZ, stepY, minY, maxY;
+        int pointsXZ, pointsY;
+        vector<float> values;
+
+        void setup(int stepxz, int stepy, int miny, int maxy);
+        float getPosXZ(int i) const { return min(i * stepXZ, int(CHUNK_SIZE)); }
+        float getPosY(int j) const { return min(minY + j * stepY, maxY); }
+        float get(int x, int y, int z) const;
+    };
+
+    // Scratch space for evaluating one column's 3D noise in batches: the points
+    // that still need a decision are gathered, sampled together and written back
+    // through index. With lattices set, fields are interpolated instead.
+    struct ColumnSamples
+    {
+        float x[CHUNK_HEIGHT], y[CHUNK_HEIGHT], z[CHUNK_HEIGHT];
+        float a[CHUNK_HEIGHT], b[CHUNK_HEIGHT], c[CHUNK_HEIGHT];
+        int index[CHUNK_HEIGHT];
+        int count;
+        int localX, localZ;
+        const NoiseLattice *lattices;
+
+        void reset() { count = 0; }
+
+        void add(float px, float py, float pz, int idx)
+        {
+            x[count] = px;
+            y[count] = py;
+            z[count] = pz;
+            index[count++] = idx;
+        }
+    };
+
+    enum
+    {
+        GENSTAGE_COLUMNS = 0,
+        GENSTAGE_CARVERS,
+        GENSTAGE_TERRAIN,
+        GENSTAGE_ORES,
+        GENSTAGE_VEGETATION,
+        GENSTAGE_SKYISLANDS,
+        GENSTAGE_KITHGARD,
+        GENSTAGE_LIGHT,
+        GENSTAGE_MESH,
+        GENSTAGE_COUNT
+    };
+
+    extern const char * const genStageNames[GENSTAGE_COUNT];
+
+    // Stage times are summed across all threads, in nanoseconds.
+    struct WorldGenStats
+    {
+        llong evaluated[LAYER_COUNT], bulkFilled[LAYER_COUNT];
+        int chunks, meshes;
+        llong stageTime[GENSTAGE_COUNT];
+    };
+
     class WorldGenerator
     {
     private:
         NoiseGenerator *noiseGen;
+        CaveCarver *caveCarver;
         unsigned int seed;
+        SDL_mutex *statsMutex;
+        WorldGenStats stats;
 
+        void sampleClimate(const float *x, const float *z, float *const *fields, int count);
+        void sampleClimateLattice(int originX, int originZ, int size, int blend, ClimateLattice &lattice);
+        void sampleColumn(int worldX, int worldZ, ColumnClimate &column);
+        double getTerrainHeight(const ColumnClimate &column);
         double getTerrainHeight(int worldX, int worldZ);
         double getSurfaceDensity(int worldX, int worldY, int worldZ);
-        bool isCave(int worldX, int worldY, int worldZ);
-        bool isKithgardCave(int worldX, int worldY, int worldZ);
-        BlockType selectBlockType(int worldX, int worldY, int worldZ, BiomeType biome, double surfaceDistance, WorldLayer layer);
+        void evaluateField(int field, const float *x, const float *y, const float *z, float *out, int count, const ColumnClimate *column);
+        void sampleField(int field, const ColumnSamples &samples, int first, int count, float *out, const ColumnClimate &column);
+        void sampleLattice(const ChunkCoord &coord, int field, NoiseLattice &lattice);
+        void findCaves(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, const CarveMask *carved, bool *open, int *evaluated);
+        void findKithgardCaves(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, const CarveMask *carved, bool *open, int *evaluated);
+        int findSkyIslands(int worldX, int worldZ, const ColumnClimate &column, ColumnSamples &samples, bool *open, int *evaluated);
+        BlockType selectBlockType(int worldX, int worldY, int worldZ, const ColumnClimate &column, double surfaceDistance, WorldLayer layer);
         void generateOres(Chunk *chunk);
-        void generateVegetation(Chunk *chunk);
+        void generateVegetation(Chunk *chunk, const ChunkColumns &columns);
         void generateSkyIslands(Chunk *chunk);
-        void generateKithgardFeatures(Chunk *chunk);
+        void generateKithgardFeatures(Chunk *chunk, const ChunkColumns &columns);
 
     public:
         WorldGenerator(unsigned int worldSeed);
         ~WorldGenerator();
 
+        void sampleColumns(int worldX, int worldZ, int spacing, bool interpolate, ChunkColumns &columns);
         void generateChunk(Chunk *chunk);
-        void generateChunkMesh(Chunk *chunk);
+        void generateChunkMesh(Chunk *chunk, Chunk *const *neighbours = NULL);
+        void generateDirtyMesh(Chunk *chunk, Chunk *const *neighbours);
         
         unsigned int getSeed() const { return seed; }
+        void getStats(WorldGenStats &out);
+        void resetStats();
     };
 }
 
@@ -0,0 +1,133 @@
+#include "game.h"
+#include "worldgenbench.h"
+
+namespace game
+{
+    struct WorldGenBenchJob
+    {
+        WorldGenerator *worldGen;
+        vector<Chunk *> *chunks;
+        SDL_mutex *mutex;
+        int next;
+    };
+
+    static int runBenchWorker(void *data)
+    {
+        WorldGenBenchJob *job = (WorldGenBenchJob *)data;
+        for(;;)
+        {
+            SDL_LockMutex(job->mutex);
+            int index = job->next++;
+            SDL_UnlockMutex(job->mutex);
+            if(index >= job->chunks->length()) break;
+
+            Chunk *chunk = (*job->chunks)[index];
+            job->worldGen->generateChunk(chunk);
+            job->worldGen->generateChunkMesh(chunk);
+        }
+        return 0;
+    }
+
+    // Generates and meshes the (2*radius+1)^2 chunks around the origin the way
+    // the streaming workers do, meshing each chunk without its neighbours. The
+    // checksum only depends on the generated blocks, so it must not change with
+    // the thread count.
+    void runWorldGenBench(unsigned int seed, int radius, int threads, WorldGenBenchResult &result)
+    {
+        memset(&result, 0, sizeof(result));
+        radius = clamp(radius, 0, 32);
+        if(threads <= 0) threads = SDL_GetCPUCount();
+        threads = clamp(threads, 1, 64);
+        result.threads = threads;
+
+        WorldGenerator *worldGen = new WorldGenerator(seed);
+        vector<Chunk *> chunks;
+        for(int x = -radius; x <= radius; ++x) for(int z = -radius; z <= radius; ++z) chunks.add(new Chunk(ChunkCoord(x, z)));
+
+        WorldGenBenchJob job;
+        job.worldGen = worldGen;
+        job.chunks = &chunks;
+        job.mutex = SDL_CreateMutex();
+        job.next = 0;
+
+        Uint64 start = SDL_GetPerformanceCounter();
+        vector<SDL_Thread *> workers;
+        loopi(threads - 1) workers.add(SDL_CreateThread(runBenchWorker, "worldgen bench", &job));
+        runBenchWorker(&job);
+        loopv(workers) SDL_WaitThread(workers[i], NULL);
+        result.seconds = double(SDL_GetPerformanceCounter() - start) / SDL_GetPerformanceFrequency();
+        SDL_DestroyMutex(job.mutex);
+
+        worldGen->getStats(result.stats);
+        result.chunks = chunks.length();
+        uint checksum = 0;
+        loopv(chunks)
+        {
+            Chunk *chunk = chunks[i];
+            for(int y = 0; y < CHUNK_HEIGHT; ++y) for(int z = 0; z < CHUNK_SIZE; ++z) for(int x = 0; x < CHUNK_SIZE; ++x)
+            {
+                Block block = chunk->getBlock(x, y, z);
+                checksum = checksum * 31 + block.type * 7 + block.data;
+            }
+            const ChunkMesh &mesh = chunk->getMesh();
+            result.meshMemory += mesh.getMemoryUsage();
+            result.blockMemory += chunk->getMemoryUsage() - mesh.getMemoryUsage();
+            result.vertices += mesh.vertices.length();
+            result.triangles += mesh.indices.length() / 3;
+        }
+        result.checksum = checksum;
+
+        chunks.deletecontents();
+        delete worldGen;
+    }
+
+    void printWorldGenBench(unsigned int seed, int radius, const WorldGenBenchResult &result)
+    {
+        if(!result.chunks) return;
+        double voxels = double(result.chunks) * CHUNK_SIZE * CHUNK_SIZE * CHUNK_HEIGHT;
+        conoutf("worldgenbench: seed %u, radius %d, %d threads: %d chunks in %.3fs", seed, radius, result.threads, result.chunks, result.seconds);
+        conoutf("  %.1f chunks/s, %.2f ns/voxel wall clock", result.chunks / max(result.seconds, 1e-9), result.seconds * 1e9 / voxels);
+
+        llong total = 0;
+        loopi(GENSTAGE_COUNT) total += result.stats.stageTime[i];
+        loopi(GENSTAGE_COUNT)
+        {
+            llong time = result.stats.stageTime[i];
+            conoutf("  %-12s %9.2f ms/chunk %6.2f ns/voxel %5.1f%%", genStageNames[i], time / 1e6 / result.chunks, time / voxels, total ? 100.0 * time / total : 0.0);
+        }
+        conoutf("  thread time %.2f ms/chunk, %.2f ns/voxel", total / 1e6 / result.chunks, total / voxels);
+        conoutf("  memory per chunk: %.1f KB blocks and light, %.1f KB mesh (%d vertices, %d triangles)",
+            result.blockMemory / 1024.0 / result.chunks, result.meshMemory / 1024.0 / result.chunks, int(result.vertices / result.chunks), int(result.triangles / result.chunks));
+        conoutf("  checksum %08x", result.checksum);
+    }
+
+#ifndef WORLDGEN_HEADLESS
+    static void cmdWorldGenBench(int *seed, int *radius, int *threads)
+    {
+        unsigned int benchSeed = *seed ? (unsigned int)*seed : 12345;
+        int benchRadius = *radius > 0 ? *radius : 2;
+        WorldGenBenchResult result;
+        runWorldGenBench(benchSeed, benchRadius, *threads, result);
+        printWorldGenBench(benchSeed, benchRadius, result);
+    }
+    ICOMMAND(worldgenbench, "iii", (int *seed, int *radius, int *threads), cmdWorldGenBench(seed, radius, threads));
+#endif
+}
+
+#ifdef WORLDGEN_HEADLESS
+int main(int argc, char **argv)
+{
+    if(argc > 5)
+    {
+        printf("usage: %s [seed] [radius] [threads] [wormcaves]\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+    unsigned int seed = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 0) : 12345;
+    int radius = argc > 2 ? atoi(argv[2]) : 2, threads = argc > 3 ? atoi(argv[3]) : 0;
+    if(argc > 4) game::wormcaves = clamp(atoi(argv[4]), 0, 7);
+    game::WorldGenBenchResult result;
+    game::runWorldGenBench(seed, radius, threads, result);
+    game::printWorldGenBench(seed, radius, result);
+    return EXIT_SUCCESS;
+}
+#endif
@@ -0,0 +1,22 @@
+#ifndef __WORLDGENBENCH_H__
+#define __WORLDGENBENCH_H__
+
+#include "worldgen.h"
+
+namespace game
+{
+    struct WorldGenBenchResult
+    {
+        int chunks, threads;
+        double seconds;
+        WorldGenStats stats;
+        size_t blockMemory, meshMemory;
+        llong vertices, triangles;
+        uint checksum;
+    };
+
+    void runWorldGenBench(unsigned int seed, int radius, int threads, WorldGenBenchResult &result);
+    void printWorldGenBench(unsigned int seed, int radius, const WorldGenBenchResult &result);
+}
+
+#endif
@@ -0,0 +1,47 @@
+#include "game.h"
+#include "worldgen.h"
+
+// Linked into the headless generator tools in place of the engine: just enough
+// of it for the world generator to run without a window. Variables keep their
+// defaults and console output goes to stdout.
+void conoutfv(int type, const char *fmt, va_list args)
+{
+    vprintf(fmt, args);
+    putchar('\n');
+}
+
+void conoutf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(CON_INFO, fmt, args);
+    va_end(args);
+}
+
+void conoutf(int type, const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    conoutfv(type, fmt, args);
+    va_end(args);
+}
+
+void fatal(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    vfprintf(stderr, fmt, args);
+    va_end(args);
+    fputc('\n', stderr);
+    exit(EXIT_FAILURE);
+}
+
+int variable(const char *name, int min, int cur, int max, int *storage, identfun fun, int flags) { return cur; }
+float fvariable(const char *name, float min, float cur, float max, float *storage, identfun fun, int flags) { return cur; }
+char *svariable(const char *name, const char *cur, char **storage, identfun fun, int flags) { return newstring(cur); }
+bool addcommand(const char *name, identfun fun, const char *args, int type) { return false; }
+
+namespace game
+{
+    int greedymesh = 1, smoothterrain = 0;
+}
@@ -107,4 +107,18 @@ namespace game
         double finalChance = baseChance * (0.5 + altitudeFactor);
         return chance < finalChance;
     }
+
+    // The island chance only grows with altitude, so a column is an island from
+    // some height upwards; returns that height, or maxY + 1 if there is none.
+    int WorldLayerManager::getFloatingIslandBase(int worldX, int worldZ, unsigned int seed, int maxY)
+    {
+        int lo = WORLD_SKIES_MIN, hi = maxY + 1;
+        while(lo < hi)
+        {
+            int mid = (lo + hi) / 2;
+            if(isFloatingIsland(worldX, mid, worldZ, seed)) hi = mid;
+            else lo = mid + 1;
+        }
+        return lo;
+    }
 }
@@ -63,6 +63,7 @@ namespace game
         static const char* getLayerName(WorldLayer layer);
         static const char* getKithgardBiomeName(KithgardBiomeType type);
         static bool isFloatingIsland(int worldX, int worldY, int worldZ, unsigned int seed);
+        static int getFloatingIslandBase(int worldX, int worldZ, unsigned int seed, int maxY);
     };
 
     static const int WORLD_SEA_LEVEL = 1200;
@@ -1233,3 +1233,101 @@ char *loadfile(const char *fn, size_t *size, bool utf8)
     return buf;
 }
 
+
+static void writepngchunk(stream *f, const char *type, const uchar *data = NULL, uint len = 0)
+{
+    f->putbig<uint>(len);
+    f->write(type, 4);
+    f->write(data, len);
+
+    uint crc = crc32(0, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)type, 4);
+    if(data) crc = crc32(crc, data, len);
+    f->putbig<uint>(crc);
+}
+
+bool writepng(stream *f, const uchar *data, int w, int h, int bpp, int pitch, bool flip, int level)
+{
+    uchar ctype = 0;
+    switch(bpp)
+    {
+        case 1: ctype = 0; break;
+        case 2: ctype = 4; break;
+        case 3: ctype = 2; break;
+        case 4: ctype = 6; break;
+        default: return false;
+    }
+
+    uchar signature[] = { 137, 80, 78, 71, 13, 10, 26, 10 };
+    f->write(signature, sizeof(signature));
+
+    struct pngihdr
+    {
+        uint width, height;
+        uchar bitdepth, colortype, compress, filter, interlace;
+    } ihdr = { bigswap<uint>(w), bigswap<uint>(h), 8, ctype, 0, 0, 0 };
+    writepngchunk(f, "IHDR", (uchar *)&ihdr, 13);
+
+    stream::offset idat = f->tell();
+    uint len = 0;
+    f->write("\0\0\0\0IDAT", 8);
+    uint crc = crc32(0, Z_NULL, 0);
+    crc = crc32(crc, (const Bytef *)"IDAT", 4);
+
+    z_stream z;
+    z.zalloc = NULL;
+    z.zfree = NULL;
+    z.opaque = NULL;
+
+    if(deflateInit(&z, level) != Z_OK) return false;
+
+    uchar buf[1<<12];
+    z.next_out = (Bytef *)buf;
+    z.avail_out = sizeof(buf);
+
+    loopi(h)
+    {
+        uchar filter = 0;
+        loopj(2)
+        {
+            z.next_in = j ? (Bytef *)data + (flip ? h-i-1 : i)*pitch : (Bytef *)&filter;
+            z.avail_in = j ? w*bpp : 1;
+            while(z.avail_in > 0)
+            {
+                if(deflate(&z, Z_NO_FLUSH) != Z_OK) goto error;
+                #define FLUSHZ do { \
+                    int flush = sizeof(buf) - z.avail_out; \
+                    crc = crc32(crc, buf, flush); \
+                    len += flush; \
+                    f->write(buf, flush); \
+                    z.next_out = (Bytef *)buf; \
+                    z.avail_out = sizeof(buf); \
+                } while(0)
+                FLUSHZ;
+            }
+        }
+    }
+
+    for(;;)
+    {
+        int err = deflate(&z, Z_FINISH);
+        if(err != Z_OK && err != Z_STREAM_END) goto error;
+        FLUSHZ;
+        if(err == Z_STREAM_END) break;
+    }
+    #undef FLUSHZ
+
+    deflateEnd(&z);
+
+    f->seek(idat, SEEK_SET);
+    f->putbig<uint>(len);
+    f->seek(0, SEEK_END);
+    f->putbig<uint>(crc);
+
+    writepngchunk(f, "IEND");
+    return true;
+
+error:
+    deflateEnd(&z);
+    return false;
+}